@@ -0,0 +1,329 @@
+#include <scheme.hpp>
+#include <garbage_collection.hpp>
+#include <jit.hpp>
+#include <native.hpp>
+#include <parser.hpp>
+#include <scheduler.hpp>
+#include <scope.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Prints one JSON object per benchmark, so that runs of different versions
+// can be compared line by line:
+// {"name": "fib/jit", "repetitions": 5, "min_s": ..., "median_s": ..., "result": "..."}
+// Usage: scheme_bench [--repetitions <n>] [--filter <substring>]
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Measurement {
+    std::vector<double> seconds;
+    std::string result;
+    // Extra numeric fields of the last repetition, like pause times.
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+struct Benchmark {
+    std::string name;
+    // Runs the benchmark once and records its time.
+    std::function<void(Measurement*)> run;
+};
+
+double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string MakeList(size_t size) {
+    std::string list = "'(";
+    for (size_t i = 0; i < size; ++i) {
+        list += std::to_string(i) + " ";
+    }
+    return list + ")";
+}
+
+// A deterministic mix of numbers, symbols, strings and nested lists.
+std::string MakeSource(size_t items) {
+    std::string source = "'(";
+    for (size_t i = 0; i < items; ++i) {
+        switch (i % 5) {
+            case 0:
+                source += std::to_string(i * 7919 % 100003);
+                break;
+            case 1:
+                source += "symbol-" + std::to_string(i % 97);
+                break;
+            case 2:
+                source += "\"string " + std::to_string(i) + "\"";
+                break;
+            case 3:
+                source += "(" + std::to_string(i) + " . " + std::to_string(i + 1) + ")";
+                break;
+            default:
+                source += "#(1 2.5 (3 4))";
+        }
+        source += i % 16 == 15 ? "\n" : " ";
+    }
+    return source + ")";
+}
+
+// Setup queries are not measured.
+Benchmark Query(std::string name, bool jit, std::vector<std::string> setup, std::string query) {
+    return {std::move(name), [jit, setup = std::move(setup), query = std::move(query)](
+                                 Measurement* measurement) {
+                SetJitEnabled(jit);
+                Interpreter interpreter;
+                for (const auto& line : setup) {
+                    interpreter.Run(line);
+                }
+                auto start = Clock::now();
+                measurement->result = interpreter.Run(query);
+                measurement->seconds.push_back(Seconds(start));
+            }};
+}
+
+Benchmark Parse(size_t items) {
+    auto source = std::make_shared<std::string>(MakeSource(items));
+    return {"parse/" + std::to_string(items), [source](Measurement* measurement) {
+                std::stringstream stream{*source};
+                auto start = Clock::now();
+                Tokenizer tokenizer(&stream);
+                Read(&tokenizer);
+                auto seconds = Seconds(start);
+                measurement->seconds.push_back(seconds);
+                measurement->metrics = {{"mb_per_s", source->size() / seconds / 1e6}};
+                Heap::Instance().MarkAndSweep(nullptr);
+            }};
+}
+
+Benchmark SerializeList(size_t size) {
+    return {"serialize/" + std::to_string(size), [size](Measurement* measurement) {
+                auto list = static_cast<Object*>(nullptr);
+                for (size_t i = size; i > 0; --i) {
+                    auto number = Heap::Instance().Make<Number>(static_cast<int64_t>(i));
+                    list = Heap::Instance().Make<Cell>(number, list);
+                }
+                auto start = Clock::now();
+                auto serialized = Serialize(list);
+                measurement->seconds.push_back(Seconds(start));
+                measurement->result = std::to_string(serialized.size()) + " chars";
+                Heap::Instance().MarkAndSweep(nullptr);
+            }};
+}
+
+// Keeps a list of `live` cells reachable while `garbage` unreachable cells
+// are allocated between collections, and reports the collection pauses.
+Benchmark CollectGarbage(size_t live, size_t garbage, size_t rounds) {
+    auto name = "gc/" + std::to_string(live) + "-live-" + std::to_string(garbage) + "-garbage";
+    return {name, [live, garbage, rounds](Measurement* measurement) {
+                auto& heap = Heap::Instance();
+                Scope root;
+                Object* list = nullptr;
+                for (size_t i = 0; i < live; ++i) {
+                    list = heap.Make<Cell>(nullptr, list);
+                }
+                root.PutObject("live", list);
+
+                std::vector<double> pauses;
+                auto total = Clock::now();
+                for (size_t round = 0; round < rounds; ++round) {
+                    for (size_t i = 0; i < garbage; ++i) {
+                        heap.Make<Cell>(nullptr, nullptr);
+                    }
+                    auto start = Clock::now();
+                    heap.MarkAndSweep(&root);
+                    pauses.push_back(Seconds(start));
+                }
+                measurement->seconds.push_back(Seconds(total));
+
+                std::sort(pauses.begin(), pauses.end());
+                measurement->metrics = {{"pause_median_ms", pauses[pauses.size() / 2] * 1e3},
+                                        {"pause_max_ms", pauses.back() * 1e3}};
+                root.PutObject("live", nullptr);
+                heap.MarkAndSweep(nullptr);
+            }};
+}
+
+// Runs a short query on each of `tenants` interpreters next to one long
+// query, and reports how long the short ones wait.
+Benchmark Schedule(size_t tenants, size_t threads) {
+    auto name = "scheduler/" + std::to_string(tenants) + "-tenants-" + std::to_string(threads) +
+                "-threads";
+    return {name, [tenants, threads](Measurement* measurement) {
+                SetJitEnabled(false);
+                const std::string fib =
+                    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))";
+                std::vector<std::unique_ptr<Interpreter>> interpreters;
+                for (size_t i = 0; i <= tenants; ++i) {
+                    interpreters.push_back(std::make_unique<Interpreter>());
+                    interpreters.back()->Run(fib);
+                }
+
+                Scheduler scheduler(threads);
+                auto start = Clock::now();
+                auto hog = scheduler.Submit(interpreters[0].get(), "(fib 25)");
+                std::vector<std::future<std::string>> results;
+                for (size_t i = 1; i <= tenants; ++i) {
+                    results.push_back(scheduler.Submit(interpreters[i].get(), "(fib 12)"));
+                }
+                std::vector<double> latencies;
+                for (auto& result : results) {
+                    result.get();
+                    latencies.push_back(Seconds(start));
+                }
+                measurement->result = hog.get();
+                measurement->seconds.push_back(Seconds(start));
+
+                std::sort(latencies.begin(), latencies.end());
+                measurement->metrics = {{"short_max_ms", latencies.back() * 1e3}};
+            }};
+}
+
+// Calls a small procedure `calls` times from the host, through a handle or
+// through a query built and parsed for each call.
+Benchmark HostCall(size_t calls, bool handle) {
+    auto name = std::string("host-call/") + (handle ? "handle-" : "query-") + std::to_string(calls);
+    return {name, [calls, handle](Measurement* measurement) {
+                SetJitEnabled(true);
+                Interpreter interpreter;
+                interpreter.Run("(define (score x w) (* (+ x 1) w))");
+                auto score = interpreter.GetProcedure("score");
+                double total = 0;
+                auto start = Clock::now();
+                for (size_t i = 0; i < calls; ++i) {
+                    auto x = static_cast<int64_t>(i % 100);
+                    if (handle) {
+                        total += score.Call<double>(x, 0.5);
+                    } else {
+                        total += std::stod(
+                            interpreter.Run("(score " + std::to_string(x) + " 0.5)"));
+                    }
+                }
+                measurement->seconds.push_back(Seconds(start));
+                measurement->result = std::to_string(total);
+            }};
+}
+
+std::vector<Benchmark> MakeBenchmarks() {
+    const std::string fib = "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))";
+    const std::string tak =
+        "(define (tak x y z) (if (not (< y x)) z "
+        "(tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))))";
+    const std::string ackermann =
+        "(define (ack m n) (if (= m 0) (+ n 1) "
+        "(if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))";
+    const std::string sum = "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))";
+    const std::string repeat_sum =
+        "(define (repeat n) (if (= n 0) 0 (+ (sum numbers 0) (repeat (- n 1)))))";
+    const std::string build =
+        "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))";
+    const std::string deep = "(define (deep n) (if (= n 0) 0 (+ 1 (deep (- n 1)))))";
+    const std::string repeat_deep =
+        "(define (repeat n) (if (= n 0) 0 (+ (deep 10000) (repeat (- n 1)))))";
+
+    std::vector<Benchmark> benchmarks;
+    for (bool jit : {false, true}) {
+        std::string mode = jit ? "/jit" : "/interpreted";
+        benchmarks.push_back(Query("fib" + mode, jit, {fib}, "(fib 25)"));
+        benchmarks.push_back(Query("tak" + mode, jit, {tak}, "(tak 18 12 6)"));
+        benchmarks.push_back(Query("ackermann" + mode, jit, {ackermann}, "(ack 2 300)"));
+        benchmarks.push_back(Query("list-sum" + mode, jit,
+                                   {sum, "(define numbers " + MakeList(1000) + ")", repeat_sum},
+                                   "(repeat 500)"));
+        benchmarks.push_back(Query("deep-recursion" + mode, jit, {deep, repeat_deep},
+                                   "(repeat 20)"));
+    }
+    benchmarks.push_back(Query("list-build", true, {build}, "(length (build 10000 '()))"));
+    benchmarks.push_back(Query("list-library", true,
+                               {"(define numbers " + MakeList(100000) + ")"},
+                               "(fold-left + 0 (map (lambda (x) (* x 2)) "
+                               "(filter (lambda (x) (= (- x (* 2 (/ x 2))) 0)) "
+                               "(reverse (append numbers numbers)))))"));
+    // Both include the collection that marks the list after the query, the
+    // difference is the part of the list the search visits.
+    for (auto target : {"10", "999999"}) {
+        benchmarks.push_back(Query(std::string("early-exit/") + target, true,
+                                   {"(define numbers " + MakeList(1000000) + ")"},
+                                   std::string("(call/cc (lambda (return) (for-each (lambda (x) "
+                                               "(if (= x ") +
+                                       target + ") (return x))) numbers) #f))"));
+    }
+    benchmarks.push_back(Query("generator/100000", true,
+                               {"(define g (make-generator (lambda (yield) "
+                               "(let loop ((i 0)) (yield i) (loop (+ i 1))))))"},
+                               "(let loop ((n 100000) (acc 0)) "
+                               "(if (= n 0) acc (loop (- n 1) (+ acc (g)))))"));
+    benchmarks.push_back(Query("stream-pipeline/20000", true,
+                               {"(define (integers-from n) "
+                                "(cons-stream n (integers-from (+ n 1))))"},
+                               "(let loop ((s (stream-filter "
+                               "(lambda (x) (= (- x (* 2 (/ x 2))) 0)) "
+                               "(stream-map (lambda (x) (* 3 x)) (integers-from 0)))) "
+                               "(n 20000)) "
+                               "(if (= n 0) (stream-car s) (loop (stream-cdr s) (- n 1))))"));
+    benchmarks.push_back(Parse(200000));
+    benchmarks.push_back(SerializeList(1000000));
+    benchmarks.push_back(CollectGarbage(100000, 500000, 10));
+    benchmarks.push_back(Schedule(1000, 4));
+    benchmarks.push_back(HostCall(100000, true));
+    benchmarks.push_back(HostCall(100000, false));
+    return benchmarks;
+}
+
+std::string Escape(std::string_view value) {
+    std::string escaped;
+    for (auto c : value) {
+        if (c == '"' || c == '\\') {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+void Print(const std::string& name, Measurement measurement) {
+    auto& seconds = measurement.seconds;
+    std::sort(seconds.begin(), seconds.end());
+    std::cout << "{\"name\": \"" << name << "\", \"repetitions\": " << seconds.size()
+              << ", \"min_s\": " << seconds.front()
+              << ", \"median_s\": " << seconds[seconds.size() / 2];
+    for (const auto& [metric, value] : measurement.metrics) {
+        std::cout << ", \"" << metric << "\": " << value;
+    }
+    if (!measurement.result.empty()) {
+        std::cout << ", \"result\": \"" << Escape(measurement.result.substr(0, 64)) << "\"";
+    }
+    std::cout << "}" << std::endl;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t repetitions = 5;
+    std::string filter;
+    for (int ind = 1; ind + 1 < argc; ind += 2) {
+        if (std::string_view(argv[ind]) == "--repetitions") {
+            repetitions = std::max(1L, std::strtol(argv[ind + 1], nullptr, 10));
+        } else if (std::string_view(argv[ind]) == "--filter") {
+            filter = argv[ind + 1];
+        }
+    }
+
+    for (const auto& benchmark : MakeBenchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        Measurement measurement;
+        for (size_t i = 0; i < repetitions; ++i) {
+            benchmark.run(&measurement);
+        }
+        Print(benchmark.name, std::move(measurement));
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Bulk byte kernels behind bytevectors. They use SSE2 when the target has it
+// and plain loops otherwise.
+
+void FillBytes(uint8_t* data, size_t size, uint8_t value);
+
+// Lexicographic comparison of two buffers of the same size: negative, zero
+// or positive like memcmp.
+int CompareBytes(const uint8_t* lhs, const uint8_t* rhs, size_t size);
+
+// Returns the offset of the first occurrence of the needle or haystack_size
+// if there is none. An empty needle is found at offset 0.
+size_t FindBytes(const uint8_t* haystack, size_t haystack_size, const uint8_t* needle,
+                 size_t needle_size);
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <func.hpp>
+#include <scope.hpp>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <ucontext.h>
+
+class Generator;
+class Heap;
+
+// (call/cc proc) calls proc with an escape continuation. Calling the
+// continuation returns its argument from call/cc at once, unwinding the
+// calls in between, so leaving a traversal early does not depend on how much
+// of it is left. Continuations are one-shot and escape only: they cannot be
+// called once call/cc has returned.
+class CallWithCurrentContinuation : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Continuation : public Procedure {
+public:
+    explicit Continuation(Generator* generator);
+    Object* Call(FunctionArgs args, Scope* scope) override;
+
+    void EndExtent();
+
+private:
+    // Stack of calls the continuation returns to, nullptr for the main one.
+    Generator* generator_;
+    bool active_{true};
+};
+
+// Stack of calls that runs on a stack of its own, with its own frame stack.
+// Resume runs it until it suspends or its body returns. Suspending leaves
+// the calls on the stack, so nothing is copied.
+class Fiber final {
+public:
+    // The body must not throw. The generator is the one its calls run in.
+    Fiber(std::function<void()> body, Generator* generator);
+    ~Fiber();
+
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+
+    void Resume();
+    // Switches back to the caller of Resume. Fibers resumed from this one
+    // that are still running are suspended with it and resumed with it.
+    void Suspend();
+    bool IsStarted() const;
+    bool IsFinished() const;
+
+    // Pushes the values of the frames and the pinned ones of the stacks of
+    // calls the thread runs, this one and the ones that resumed it, and
+    // their words and saved registers, which may point to objects.
+    static void FindRunningRoots(std::vector<Object*>* roots, std::vector<const void*>* words);
+    // Same for a fiber that is suspended.
+    void FindSuspendedRoots(std::vector<Object*>* roots, std::vector<const void*>* words) const;
+
+private:
+    // What the thread runs, switched with the stack.
+    struct Context {
+        Fiber* fiber;
+        FrameStack* frames;
+        Heap* heap;
+        Generator* generator;
+    };
+
+    static Context GetContext();
+    static void SetContext(const Context& context);
+    static void Run();
+
+private:
+    static thread_local Fiber* current_;
+
+    std::function<void()> body_;
+    FrameStack frames_;
+    // Context of the calls of the fiber while it is suspended, and of its
+    // caller while it runs.
+    Context context_;
+    Context caller_{};
+    bool finished_{false};
+
+    void* stack_{};
+    ucontext_t fiber_context_{};
+    ucontext_t caller_context_{};
+    // Lowest addresses in use on the stacks when they were switched.
+    const void* stack_pointer_{};
+    const void* caller_stack_pointer_{};
+    // Stack of the caller, for sanitizers.
+    const void* caller_stack_{};
+    size_t caller_stack_size_{0};
+
+    size_t profile_base_{0};
+    uint64_t profile_generation_{0};
+    std::vector<uint32_t> profile_frames_;
+};
+
+// (make-generator proc) runs proc, a procedure of a yield procedure, as a
+// coroutine on a fiber. Calling the generator runs proc until it yields a
+// value or returns one. (g value) resumes with value as the result of the
+// yield.
+class MakeGenerator : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsGeneratorDone : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Generator : public Procedure {
+public:
+    Generator(Procedure* proc, Scope* global_scope);
+    ~Generator() override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
+
+    // Switches back to the caller, returns the value of the next resume.
+    Object* Yield(Object* value);
+    bool IsDone() const;
+
+    // Generator whose stack is running, nullptr for the main stack.
+    static Generator* Current();
+    Generator* GetResumer() const;
+
+    // Calls on the stack of a suspended generator may reference objects
+    // that marking does not reach. Returns false if any suspended generator
+    // of the heap is marked, so the roots of their stacks must be marked
+    // too. Otherwise unwinds the stacks of the suspended ones, which are
+    // garbage, so that nothing they hold is used after the sweep.
+    static bool PrepareSweep(const Heap* heap);
+
+    // Pushes the roots of the stacks of calls of the thread and of the
+    // suspended generators of the heap, together with those generators, for
+    // collections during a query.
+    static void FindRoots(const Heap* heap, std::vector<Object*>* roots,
+                          std::vector<const void*>* words);
+
+private:
+    enum class State { kCreated, kSuspended, kRunning, kDone };
+
+    void Run();
+    Object* Resume(Object* value);
+
+private:
+    static thread_local Generator* current_;
+    static std::mutex suspended_mutex_;
+    static std::unordered_set<Generator*> suspended_;
+
+    Procedure* proc_;
+    Object* yield_;
+    Scope* global_scope_;
+    const Heap* heap_;
+    State state_{State::kCreated};
+    Fiber fiber_;
+    Generator* resumer_{};
+
+    // Value passed by the last switch between the stacks.
+    Object* transfer_{};
+    std::exception_ptr exception_;
+    bool cancelled_{false};
+
+    friend class Fiber;
+};
+
+class GeneratorYield : public Procedure {
+public:
+    explicit GeneratorYield(Generator* generator);
+    Object* Call(FunctionArgs args, Scope* scope) override;
+
+private:
+    Generator* generator_;
+};
+
+// Budget of the running evaluation: every call and loop iteration burns a
+// unit, and the evaluation suspends when its slice is used up. Outside of
+// evaluations it never runs out.
+class Fuel final {
+public:
+    static void Burn() {
+        if (--remaining_ == 0) [[unlikely]] {
+            Exhaust();
+        }
+    }
+
+private:
+    static void Exhaust();
+
+private:
+    static thread_local uint64_t remaining_;
+
+    friend class Evaluation;
+};
+
+// Query that runs in slices of fuel on a fiber of its own, so that it can
+// be suspended anywhere and resumed later, on the same thread.
+class Evaluation final {
+public:
+    explicit Evaluation(std::function<std::string()> body);
+    // Unwinds the calls of an evaluation that has not finished.
+    ~Evaluation();
+
+    Evaluation(const Evaluation&) = delete;
+    Evaluation& operator=(const Evaluation&) = delete;
+
+    // Runs until the query finishes or fuel units are burnt. Returns true
+    // once it has finished.
+    bool Resume(uint64_t fuel);
+    bool IsDone() const;
+    uint64_t GetFuelUsed() const;
+
+    // Result of a finished evaluation, or the error it ended with.
+    std::string GetResult() const;
+
+private:
+    void Run();
+
+private:
+    static thread_local Evaluation* current_;
+
+    std::function<std::string()> body_;
+    Fiber fiber_;
+    uint64_t fuel_used_{0};
+    bool cancelled_{false};
+    std::string result_;
+    std::exception_ptr exception_;
+
+    friend class Fuel;
+};
@@ -2,24 +2,53 @@
 
 #include <scope.hpp>
 #include <object.hpp>
+#include <instrumentation.hpp>
+#include <algorithm>
+#include <compare>
+#include <cstdint>
+#include <memory>
 
 Object* Process(Object* obj, Scope* scope);
 
+// Arguments of a call. They live on the frame stack, or in a vector for
+// calls made by builtins, and are not copied.
 class FunctionArgs final {
 public:
-    using Type = std::vector<Object*>;
-    using Iterator = Type::iterator;
+    using Iterator = Object**;
 
-    FunctionArgs(Iterator begin, Iterator end);
+    FunctionArgs(Iterator begin, Iterator end, Object* head = nullptr)
+        : begin_(begin), end_(end), head_(head) {
+    }
+
+    explicit FunctionArgs(std::vector<Object*>& args)
+        : FunctionArgs(args.data(), args.data() + args.size()) {
+    }
+
+    Object* operator[](size_t ind) const {
+        return begin_[ind];
+    }
 
-    Object* operator[](size_t ind) const;
-    Object* Back() const;
-    size_t Size() const;
+    Object* Back() const {
+        return end_[-1];
+    }
 
-    void SkipLast();
+    size_t Size() const {
+        return end_ - begin_;
+    }
 
-    Iterator begin() const;  // NOLINT
-    Iterator end() const;    // NOLINT
+    // Head of the evaluated form, if any. The reader allocates a symbol per
+    // occurrence, so special forms may cache per call site data on it.
+    Object* GetHead() const {
+        return head_;
+    }
+
+    Iterator begin() const {  // NOLINT
+        return begin_;
+    }
+
+    Iterator end() const {  // NOLINT
+        return end_;
+    }
 
     template <typename T>
     bool AreExpectedType() const {
@@ -29,208 +58,640 @@ public:
 private:
     Iterator begin_;
     Iterator end_;
+    Object* head_;
 };
 
 class Function : public Object {
 public:
-    virtual Function* Execute(FunctionArgs args, Scope* scope) = 0;
+    virtual Object* Execute(FunctionArgs args, Scope* scope) = 0;
+
+    // Pure functions evaluate all their arguments and have no side effects,
+    // so a call on literals may be folded before evaluation.
+    virtual bool IsPure() const;
+};
+
+// Numbers of arguments a procedure accepts and the error for the others.
+struct Arity {
+    size_t min{0};
+    size_t max{SIZE_MAX};
+    const char* message{""};
 };
 
-class ObjectHolder : public Function {
+// Function that receives its arguments evaluated from left to right. Their
+// number is checked against its arity before its call, so Call may assume it.
+class Procedure : public Function {
 public:
-    ObjectHolder(Object* object, Scope* scope = nullptr);
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    explicit Procedure(Arity arity = {});
 
-    Scope* GetScope() const;
-    Object* GetObject() const;
-    const std::string& GetName() const;
+    Object* Execute(FunctionArgs args, Scope* scope) final;
+    // Calls with arguments that are already evaluated.
+    Object* Invoke(FunctionArgs args, Scope* scope);
+    virtual Object* Call(FunctionArgs args, Scope* scope) = 0;
 
-    void SetObject(Object* object);
-    void SetName(std::string name);
+private:
+    void CheckArity(size_t size) const;
 
 private:
-    Object* object_;
-    Scope* scope_;
-    std::string name_;
+    Arity arity_;
 };
 
-class IsBoolean : public Function {
+class IsBoolean : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    IsBoolean();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class Not : public Function {
+class Not : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Not();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
 class And : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
 class Or : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class IsNumber : public Function {
+class IsNumber : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    IsNumber();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class Equal : public Function {
+// Compares each number with the next one, like (< a b c). Holds tells if the
+// ordering of a pair satisfies the comparison.
+template <bool (*Holds)(std::partial_ordering)>
+class NumberComparison : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class MonotonicallyIncreasing : public Function {
+using Equal = NumberComparison<std::is_eq>;
+using MonotonicallyIncreasing = NumberComparison<std::is_lt>;
+using MonotonicallyDecreasing = NumberComparison<std::is_gt>;
+using MonotonicallyNonIncreasing = NumberComparison<std::is_gteq>;
+using MonotonicallyNonDecreasing = NumberComparison<std::is_lteq>;
+
+class Plus : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class MonotonicallyDecreasing : public Function {
+class Minus : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Minus();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class MonotonicallyNonIncreasing : public Function {
+class Multiply : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class MonotonicallyNonDecreasing : public Function {
+class Divide : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Divide();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class Plus : public Function {
+class Quote : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
 };
 
-class Minus : public Function {
+class Max : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Max();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class Multiply : public Function {
+class Min : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Min();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class Divide : public Function {
+class Abs : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Abs();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
-class Quote : public Function {
+class IsPair : public Procedure {
+public:
+    IsPair();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsNull : public Procedure {
+public:
+    IsNull();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsList : public Procedure {
+public:
+    IsList();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Cons : public Procedure {
+public:
+    Cons();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Car : public Procedure {
+public:
+    Car();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Cdr : public Procedure {
+public:
+    Cdr();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class List : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class ListRef : public Procedure {
+public:
+    ListRef();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class ListTail : public Procedure {
+public:
+    ListTail();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Length : public Procedure {
+public:
+    Length();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Append : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Reverse : public Procedure {
+public:
+    Reverse();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Map : public Procedure {
+public:
+    Map();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class ForEach : public Procedure {
+public:
+    ForEach();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Filter : public Procedure {
+public:
+    Filter();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class FoldLeft : public Procedure {
+public:
+    FoldLeft();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class FoldRight : public Procedure {
+public:
+    FoldRight();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Assoc : public Procedure {
+public:
+    Assoc();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Member : public Procedure {
+public:
+    Member();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class Apply : public Procedure {
+public:
+    Apply();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsVector : public Procedure {
+public:
+    IsVector();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class MakeVector : public Procedure {
+public:
+    MakeVector();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class CreateVector : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class VectorLength : public Procedure {
+public:
+    VectorLength();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class VectorRef : public Procedure {
+public:
+    VectorRef();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class VectorSet : public Procedure {
+public:
+    VectorSet();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class VectorFill : public Procedure {
+public:
+    VectorFill();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsBytevector : public Procedure {
+public:
+    IsBytevector();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class MakeBytevector : public Procedure {
+public:
+    MakeBytevector();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class CreateBytevector : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorLength : public Procedure {
+public:
+    BytevectorLength();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorRef : public Procedure {
+public:
+    BytevectorRef();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorSet : public Procedure {
+public:
+    BytevectorSet();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorCopy : public Procedure {
+public:
+    BytevectorCopy();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorFill : public Procedure {
+public:
+    BytevectorFill();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorEqual : public Procedure {
+public:
+    BytevectorEqual();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorCompare : public Procedure {
+public:
+    BytevectorCompare();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class BytevectorSearch : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    BytevectorSearch();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class Max : public Function {
+class IsHashTable : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    IsHashTable();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class Min : public Function {
+class MakeHashTable : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    MakeHashTable();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class Abs : public Function {
+class HashTableRef : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    HashTableRef();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class IsPair : public Function {
+class HashTableSet : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    HashTableSet();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class IsNull : public Function {
+class HashTableDelete : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    HashTableDelete();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class IsList : public Function {
+class HashTableCount : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    HashTableCount();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class Cons : public Function {
+class HashTableWalk : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    HashTableWalk();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class Car : public Function {
+class IsString : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    IsString();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class Cdr : public Function {
+class StringLength : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    StringLength();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class List : public Function {
+class StringRef : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    StringRef();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class ListRef : public Function {
+class Substring : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Substring();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class ListTail : public Function {
+class StringEqual : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class IsSymbol : public Function {
+class StringAppend : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class StringToSymbol : public Procedure {
+public:
+    StringToSymbol();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class ConvertNumberToString : public Procedure {
+public:
+    ConvertNumberToString();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// (profile-start [interval-in-microseconds])
+class ProfileStart : public Procedure {
+public:
+    ProfileStart();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// (profile-stop "file") writes the folded stacks sampled since profile-start.
+class ProfileStop : public Procedure {
+public:
+    ProfileStop();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsSymbol : public Procedure {
+public:
+    IsSymbol();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+    bool IsPure() const override;
 };
 
 class Define : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
 };
 
 class Set : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
 };
 
-class SetCar : public Function {
+class SetCar : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
-class SetCdr : public Function {
+class SetCdr : public Procedure {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
 };
 
 class If : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
 };
 
 class CreateLambda : public Function {
 public:
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+// Closure without parameters that evaluates body, like (lambda () body...)
+// at the call site of head.
+Object* MakeThunk(Object* head, std::vector<Object*> body, Scope* scope);
+
+// Binding forms evaluate their body in a frame on the frame stack, which
+// they extend in place instead of creating a closure.
+
+// (let ((name init) ...) body...) and the named let
+// (let loop ((name init) ...) body...), whose calls of loop in tail position
+// rebind the names in the same frame instead of recursing.
+class Let : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+class LetStar : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+class Letrec : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+// (do ((name init [step]) ...) (test expr...) command...) updates its
+// names in the same frame on every iteration.
+class Do : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+// What a lambda form binds and refers to, computed once per form.
+struct LambdaInfo {
+    // Parameter list of the analyzed form, the head symbol may be shared.
+    Object* source;
+    // Offset of the form in its query.
+    size_t position;
+    std::vector<Object*> params;
+    std::vector<Object*> body;
+    // Names the body refers to without binding them itself.
+    std::vector<std::string> free_variables;
+    // Parameters and internal defines that live in boxes because they are
+    // assigned or defined after closures may have captured them.
+    std::vector<bool> boxed_params;
+    std::vector<std::string> boxed_defines;
 };
 
-class Lambda : public Function {
+class NativeCode;
+
+// Flat closure: free variables bound outside the global scope are captured
+// one by one when the closure is created, other names resolve globally.
+class Lambda : public Procedure {
 public:
-    Lambda(std::vector<Object*> args, std::vector<Object*> body, Scope* parent_scope);
-    Function* Execute(FunctionArgs args, Scope* scope) override;
+    using Captures = std::vector<std::pair<const std::string*, Object*>>;
+
+    Lambda(std::shared_ptr<const LambdaInfo> info, Captures captures, Scope* global_scope);
+    ~Lambda() override;
+    Object* Call(FunctionArgs args, Scope* scope) override;
+
+    // The name the lambda was first defined with, profiles show it.
+    const std::string& GetName() const;
+    void SetName(const std::string& name);
 
 private:
-    std::vector<Object*> args_;
-    std::vector<Object*> body_;
-    Scope* parent_scope_;
+    std::shared_ptr<const LambdaInfo> info_;
+    // Values of immutable captured variables and boxes of the others.
+    Captures captures_;
+    Scope* global_scope_;
+
+    std::string name_;
+    uint64_t profile_generation_{0};
+    uint32_t profile_label_{0};
+    [[no_unique_address]] LambdaSpan<>::Cache instrumentation_cache_;
+
+    // Calls counted until the body is compiled to machine code.
+    size_t calls_{0};
+    std::unique_ptr<NativeCode> native_code_;
 };
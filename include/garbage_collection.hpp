@@ -1,7 +1,9 @@
 #pragma once
 
+#include <instrumentation.hpp>
 #include <unordered_set>
 #include <memory>
+#include <vector>
 
 class Scope;
 class Object;
@@ -14,24 +16,84 @@ public:
     Heap(Heap&&) = delete;
     Heap& operator=(Heap&&) = delete;
 
+    Heap() = default;
+
+    // Heap of the interpreter that runs on this thread. Every interpreter
+    // has one of its own and switches to it while it runs, so that a query
+    // never collects the objects of another interpreter.
     static Heap& Instance();
+    static void SetInstance(Heap* heap);
 
     template <typename T, typename... Args>
     Object* Make(Args&&... args);
 
     void MarkAndSweep(Scope* root);
 
+    // Limit on the number of objects, 0 for none. An allocation past the
+    // limit collects the heap if a query is being evaluated, and fails with
+    // a RuntimeError unless an eighth of the limit is free after that.
+    void SetLimit(size_t objects);
+    size_t GetSize() const;
+
+    // While a query is evaluated, allocations past the limit may collect the
+    // heap. The roots are then the scope, the query and what the stacks of
+    // calls hold: the values of their frames, pinned values, and the words
+    // of the stacks and saved registers that point to objects.
+    void BeginEvaluation(Scope* root, Object* query);
+    void EndEvaluation();
+
+    // Objects the host holds between queries, roots of every collection
+    // until they are released as often as they were retained.
+    void Retain(Object* obj);
+    void Release(Object* obj);
+
 private:
-    Heap() = default;
+    void Reclaim(Object* allocated);
+    // Objects the stacks of calls of the thread and the suspended generators
+    // of the heap hold, with those generators.
+    std::vector<Object*> FindStackRoots() const;
+    static void SetMarked(const std::vector<Object*>& roots, bool marked);
+    void Sweep();
 
 private:
+    static Heap main_;
+    static thread_local Heap* instance_;
+
     std::unordered_set<std::unique_ptr<Object>> heap_;
+    size_t limit_{0};
+    Scope* root_{};
+    Object* query_{};
+    size_t pauses_{0};
+    std::unordered_multiset<Object*> retained_;
+
+    friend class CollectionPause;
+};
+
+// Keeps allocations from collecting the heap of the thread until the end of
+// the scope, for code that holds new objects where collections do not look.
+class CollectionPause final {
+public:
+    CollectionPause();
+    ~CollectionPause();
+
+    CollectionPause(const CollectionPause&) = delete;
+    CollectionPause& operator=(const CollectionPause&) = delete;
+
+private:
+    Heap& heap_;
 };
 
 template <typename T, typename... Args>
 Object* Heap::Make(Args&&... args) {
+    if constexpr (kInstrumentationEnabled) {
+        Instrumentation::Instance().CountAllocation(typeid(T));
+    }
     std::unique_ptr<T> object = std::make_unique<T>(std::forward<Args>(args)...);
     auto* ptr = object.get();
     heap_.insert(std::move(object));
+    // Checked once the object is made, so that it keeps what it was made of.
+    if (limit_ != 0 && heap_.size() > limit_) [[unlikely]] {
+        Reclaim(ptr);
+    }
     return ptr;
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+// Counters and trace events of the evaluator, compiled in with the
+// SCHEME_INSTRUMENTATION CMake option. Hooks are guarded by
+// kInstrumentationEnabled or are empty specializations otherwise, so
+// regular builds do not carry them.
+#ifdef SCHEME_INSTRUMENTATION
+constexpr bool kInstrumentationEnabled = true;
+#else
+constexpr bool kInstrumentationEnabled = false;
+#endif
+
+class Instrumentation final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct LambdaCounters {
+        uint64_t calls{0};
+        // Inclusive time, recursive calls are counted in every frame.
+        Clock::duration time{};
+    };
+
+    Instrumentation(const Instrumentation&) = delete;
+    Instrumentation& operator=(const Instrumentation&) = delete;
+
+    static Instrumentation& Instance();
+
+    // Calls of builtins and special forms evaluated from forms.
+    void CountCall(const std::type_info& type);
+    // Number of scopes above the one a name was found in.
+    void CountLookup(size_t depth);
+    void CountInlineCacheHit();
+    void CountAllocation(const std::type_info& type);
+    // The counters of a label are kept until Reset.
+    LambdaCounters* GetLambdaCounters(const std::string& label);
+    uint64_t GetGeneration() const;
+
+    // Complete event of the trace, events beyond the limit are counted only.
+    void AddEvent(const std::string& name, const char* category, Clock::time_point start,
+                  Clock::time_point end);
+
+    // One "kind name value..." record per line.
+    void WriteCounters(std::ostream* out) const;
+    // Chrome trace-event JSON, loadable in chrome://tracing or Perfetto.
+    void WriteTrace(std::ostream* out) const;
+    void Reset();
+
+private:
+    Instrumentation();
+
+    struct Event {
+        std::string name;
+        const char* category;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+private:
+    Clock::time_point origin_;
+    uint64_t generation_{1};
+    std::unordered_map<std::type_index, uint64_t> calls_;
+    std::unordered_map<std::string, LambdaCounters> lambdas_;
+    std::vector<uint64_t> lookups_;
+    uint64_t inline_cache_hits_{0};
+    std::unordered_map<std::type_index, uint64_t> allocations_;
+    std::vector<Event> events_;
+    uint64_t dropped_events_{0};
+};
+
+// Records a span of the trace from construction to destruction.
+template <bool Enabled = kInstrumentationEnabled>
+class TraceSpan final {
+public:
+    TraceSpan(const char* name, const char* category)
+        : name_(name), category_(category), start_(Instrumentation::Clock::now()) {
+    }
+
+    ~TraceSpan() {
+        Instrumentation::Instance().AddEvent(name_, category_, start_,
+                                             Instrumentation::Clock::now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    const char* category_;
+    Instrumentation::Clock::time_point start_;
+};
+
+template <>
+class TraceSpan<false> final {
+public:
+    TraceSpan(const char*, const char*) {
+    }
+};
+
+// Counts a lambda call, its time and records it as a span. The counters are
+// looked up by label once per lambda and generation of the counters.
+template <bool Enabled = kInstrumentationEnabled>
+class LambdaSpan final {
+public:
+    struct Cache {
+        Instrumentation::LambdaCounters* counters{};
+        uint64_t generation{0};
+        std::string label;
+    };
+
+    LambdaSpan(const std::string& name, size_t position, Cache* cache)
+        : cache_(cache), start_(Instrumentation::Clock::now()) {
+        auto& instrumentation = Instrumentation::Instance();
+        if (cache_->generation != instrumentation.GetGeneration()) {
+            cache_->label = (name.empty() ? "lambda" : name) + "@" + std::to_string(position);
+            cache_->counters = instrumentation.GetLambdaCounters(cache_->label);
+            cache_->generation = instrumentation.GetGeneration();
+        }
+        ++cache_->counters->calls;
+    }
+
+    ~LambdaSpan() {
+        auto end = Instrumentation::Clock::now();
+        auto& instrumentation = Instrumentation::Instance();
+        if (cache_->generation == instrumentation.GetGeneration()) {
+            cache_->counters->time += end - start_;
+        }
+        instrumentation.AddEvent(cache_->label, "lambda", start_, end);
+    }
+
+    LambdaSpan(const LambdaSpan&) = delete;
+    LambdaSpan& operator=(const LambdaSpan&) = delete;
+
+private:
+    Cache* cache_;
+    Instrumentation::Clock::time_point start_;
+};
+
+template <>
+class LambdaSpan<false> final {
+public:
+    struct Cache {};
+
+    LambdaSpan(const std::string&, size_t, Cache*) {
+    }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <func.hpp>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Lambdas are interpreted until they have been called kJitThreshold times,
+// then their body is compiled to x86-64 machine code if it only uses fixnum
+// arithmetic, comparisons, not, if, car, cdr, null? and calls to itself.
+constexpr size_t kJitThreshold = 1000;
+
+void SetJitEnabled(bool enabled);
+bool IsJitEnabled();
+
+class ExecutableMemory;
+
+// Machine code of one lambda body. The supported forms have no side effects,
+// so whenever a guard fails (a non-fixnum operand, an overflow, a rebound
+// builtin) the whole native call is abandoned and the caller interprets the
+// body from the start.
+class NativeCode final {
+public:
+    enum class Type { kUnknown, kInt, kBool, kObj };
+
+    // Names the code resolved in the global scope and the values it relies on.
+    using Dependencies = std::vector<std::pair<std::string, Object*>>;
+
+    NativeCode(std::unique_ptr<ExecutableMemory> memory, std::vector<Type> param_types,
+               Type result_type, Dependencies dependencies, Scope* global_scope);
+    ~NativeCode();
+
+    // Returns nothing if the call has to be interpreted.
+    std::optional<Object*> Run(FunctionArgs args);
+
+private:
+    bool CheckDependencies();
+
+private:
+    std::unique_ptr<ExecutableMemory> memory_;
+    std::vector<Type> param_types_;
+    Type result_type_;
+    Dependencies dependencies_;
+    Scope* global_scope_;
+    uint64_t checked_version_;
+    size_t bailouts_{0};
+    bool disabled_{false};
+};
+
+// Returns nullptr if the body is not supported or the target is not x86-64.
+std::unique_ptr<NativeCode> CompileLambda(Lambda* lambda, const std::vector<Object*>& params,
+                                          const std::vector<Object*>& body, Scope* scope);
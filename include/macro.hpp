@@ -0,0 +1,50 @@
+#pragma once
+
+#include <func.hpp>
+#include <scope.hpp>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Transformer of a syntax-rules macro. Uses of a macro are expanded once:
+// ExpandMacros replaces them in a query before it is analyzed, and a use it
+// cannot see is expanded on its first evaluation and cached on its head.
+class SyntaxRules : public Function {
+public:
+    struct Rule {
+        Object* pattern;
+        Object* templ;
+        // Names the template binds itself, renamed in every expansion so that
+        // they do not capture names of the use.
+        std::unordered_set<std::string> renamed;
+    };
+
+    SyntaxRules(std::unordered_set<std::string> literals, std::vector<Rule> rules);
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+
+    // Returns the expansion of a use, whose head is the keyword.
+    Object* Expand(Object* form) const;
+
+    void SetName(const std::string& name);
+
+private:
+    std::unordered_set<std::string> literals_;
+    std::vector<Rule> rules_;
+    std::string name_;
+};
+
+// (syntax-rules (literal ...) (pattern template) ...)
+class CreateSyntaxRules : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+// (define-syntax name transformer), macros are bound in the global scope only.
+class DefineSyntax : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+// Replaces the uses of macros bound in the global scope, except under names
+// bound locally, in place.
+Object* ExpandMacros(Object* obj, Scope* global_scope);
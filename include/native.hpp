@@ -0,0 +1,244 @@
+#pragma once
+
+#include <scheme.hpp>
+#include <func.hpp>
+#include <error.hpp>
+#include <garbage_collection.hpp>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Conversions of the parameters and results of native functions. Convert
+// returns false if the object is not of the type, Make boxes a result.
+template <typename T>
+struct NativeValue;
+
+// Exact integers in the range of the type.
+template <std::integral T>
+    requires(!std::same_as<T, bool>)
+struct NativeValue<T> {
+    static constexpr std::string_view kName = "<Integer>";
+
+    static bool Convert(Object* obj, T* value) {
+        auto number =
+            Is<Number>(obj) ? std::get_if<int64_t>(&As<Number>(obj)->GetValue()) : nullptr;
+        if (!number || !std::in_range<T>(*number)) {
+            return false;
+        }
+        *value = static_cast<T>(*number);
+        return true;
+    }
+
+    static Object* Make(T value, Scope*) {
+        if (std::in_range<int64_t>(value)) {
+            return Heap::Instance().Make<Number>(static_cast<int64_t>(value));
+        }
+        return Heap::Instance().Make<Number>(BigInteger::Parse(std::to_string(value)));
+    }
+};
+
+// Any number, exact ones are converted.
+template <std::floating_point T>
+struct NativeValue<T> {
+    static constexpr std::string_view kName = "<Number>";
+
+    static bool Convert(Object* obj, T* value) {
+        if (!Is<Number>(obj)) {
+            return false;
+        }
+        *value = static_cast<T>(ToDouble(As<Number>(obj)->GetValue()));
+        return true;
+    }
+
+    static Object* Make(T value, Scope*) {
+        return Heap::Instance().Make<Number>(static_cast<double>(value));
+    }
+};
+
+template <>
+struct NativeValue<bool> {
+    static constexpr std::string_view kName = "<Boolean>";
+
+    static bool Convert(Object* obj, bool* value) {
+        if (!Is<Symbol>(obj)) {
+            return false;
+        }
+        const auto& name = As<Symbol>(obj)->GetName();
+        *value = name == "#t";
+        return *value || name == "#f";
+    }
+
+    static Object* Make(bool value, Scope* scope) {
+        return scope->GetObject(value ? "#t" : "#f");
+    }
+};
+
+// Views stay valid for the call, its arguments are not collected before it
+// returns.
+template <>
+struct NativeValue<std::string_view> {
+    static constexpr std::string_view kName = "<String>";
+
+    static bool Convert(Object* obj, std::string_view* value) {
+        if (!Is<String>(obj)) {
+            return false;
+        }
+        *value = As<String>(obj)->GetValue();
+        return true;
+    }
+
+    static Object* Make(std::string_view value, Scope*) {
+        return Heap::Instance().Make<String>(std::string(value));
+    }
+};
+
+template <>
+struct NativeValue<std::string> {
+    static constexpr std::string_view kName = "<String>";
+
+    static bool Convert(Object* obj, std::string* value) {
+        if (!Is<String>(obj)) {
+            return false;
+        }
+        *value = As<String>(obj)->GetValue();
+        return true;
+    }
+
+    static Object* Make(std::string value, Scope*) {
+        return Heap::Instance().Make<String>(std::move(value));
+    }
+};
+
+template <>
+struct NativeValue<const char*> {
+    static Object* Make(const char* value, Scope*) {
+        return Heap::Instance().Make<String>(value);
+    }
+};
+
+// Any value, unconverted.
+template <>
+struct NativeValue<Object*> {
+    static constexpr std::string_view kName = "<Obj>";
+
+    static bool Convert(Object* obj, Object** value) {
+        *value = obj;
+        return true;
+    }
+
+    static Object* Make(Object* value, Scope*) {
+        return value;
+    }
+};
+
+// Result and parameter types of a function pointer, lambda or other
+// function object with a single call operator.
+template <typename F>
+struct NativeSignature : NativeSignature<decltype(&F::operator())> {};
+
+template <typename R, typename... Args>
+struct NativeSignature<R (*)(Args...)> {
+    using Result = std::decay_t<R>;
+    using Params = std::tuple<std::decay_t<Args>...>;
+};
+
+template <typename R, typename... Args>
+struct NativeSignature<R (*)(Args...) noexcept> : NativeSignature<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...)> : NativeSignature<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) const> : NativeSignature<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) noexcept> : NativeSignature<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) const noexcept> : NativeSignature<R (*)(Args...)> {};
+
+// Procedure that calls a C++ function. The checks and conversions of its
+// arguments are generated for its signature, so a call costs the virtual
+// call of any procedure and the conversions.
+template <typename F>
+class NativeProcedure : public Procedure {
+public:
+    using Result = typename NativeSignature<F>::Result;
+    using Params = typename NativeSignature<F>::Params;
+
+    static constexpr size_t kArity = std::tuple_size_v<Params>;
+
+    NativeProcedure(const std::string& name, F func)
+        : func_(std::move(func)),
+          message_(MakeMessage(name, std::make_index_sequence<kArity>{})) {
+    }
+
+    Object* Call(FunctionArgs args, Scope* scope) override {
+        ThrowRuntimeErrorIf(args.Size() != kArity, message_);
+        return CallConverted(args, scope, std::make_index_sequence<kArity>{});
+    }
+
+private:
+    template <size_t... I>
+    Object* CallConverted(const FunctionArgs& args, Scope* scope, std::index_sequence<I...>) {
+        Params params;
+        auto converted =
+            (NativeValue<std::tuple_element_t<I, Params>>::Convert(args[I], &std::get<I>(params)) &&
+             ...);
+        ThrowRuntimeErrorIf(!converted, message_);
+        if constexpr (std::is_void_v<Result>) {
+            std::apply(func_, std::move(params));
+            return nullptr;
+        } else {
+            return NativeValue<Result>::Make(std::apply(func_, std::move(params)), scope);
+        }
+    }
+
+    // Like "name: expected <Integer> <String>".
+    template <size_t... I>
+    static std::string MakeMessage(const std::string& name, std::index_sequence<I...>) {
+        std::string message = name + ": expected";
+        ((message += ' ', message += NativeValue<std::tuple_element_t<I, Params>>::kName), ...);
+        return kArity == 0 ? message + " no arguments" : message;
+    }
+
+private:
+    F func_;
+    std::string message_;
+};
+
+template <typename F>
+void Interpreter::RegisterNative(const std::string& name, F func) {
+    BindGlobal(name, [&name, &func] {
+        return Heap::Instance().Make<NativeProcedure<F>>(name, std::move(func));
+    });
+}
+
+template <typename R, typename... Args>
+R ProcedureHandle::Call(const Args&... args) {
+    static_assert(!std::is_same_v<R, std::string_view> && !std::is_same_v<R, Object*>,
+                  "The result would not outlive the garbage of the call");
+
+    CallScope call_scope(interpreter_);
+    auto scope = call_scope.GetGlobalScope();
+    // Collections during the call find the arguments on this stack. String
+    // literals decay to const char*.
+    std::array<Object*, sizeof...(Args)> objects{
+        NativeValue<std::decay_t<const Args>>::Make(args, scope)...};
+    auto result = As<Procedure>(proc_)->Invoke(
+        FunctionArgs(objects.data(), objects.data() + objects.size()), scope);
+
+    if constexpr (!std::is_void_v<R>) {
+        R value;
+        if (!NativeValue<R>::Convert(result, &value)) {
+            throw RuntimeError(name_ + ": expected a result of type " +
+                               std::string(NativeValue<R>::kName));
+        }
+        return value;
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <compare>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// Arbitrary precision integer kept as a sign and a magnitude of little-endian
+// 32-bit limbs without leading zero limbs.
+class BigInteger {
+public:
+    using Limb = uint32_t;
+    using Limbs = std::vector<Limb>;
+
+    BigInteger() = default;
+    BigInteger(int64_t value);
+
+    // Parses an optionally signed decimal literal.
+    static BigInteger Parse(std::string_view literal);
+
+    // Truncates the fractional part of a finite value.
+    static BigInteger FromDouble(double value);
+
+    bool IsNegative() const;
+    bool FitsInt64() const;
+    int64_t ToInt64() const;
+    double ToDouble() const;
+    std::string ToString() const;
+    size_t Hash() const;
+
+    BigInteger operator-() const;
+
+    friend BigInteger operator+(const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator-(const BigInteger& lhs, const BigInteger& rhs);
+    friend BigInteger operator*(const BigInteger& lhs, const BigInteger& rhs);
+    // Truncates towards zero.
+    friend BigInteger operator/(const BigInteger& lhs, const BigInteger& rhs);
+
+    friend bool operator==(const BigInteger& lhs, const BigInteger& rhs) = default;
+    friend std::strong_ordering operator<=>(const BigInteger& lhs, const BigInteger& rhs);
+
+private:
+    BigInteger(bool negative, Limbs magnitude);
+
+private:
+    bool negative_{false};
+    Limbs magnitude_;
+};
+
+// Exact integers that fit into int64_t are always kept as fixnums. The order
+// of the alternatives is the order of promotion in mixed arithmetic.
+using NumberValue = std::variant<int64_t, BigInteger, double>;
+
+NumberValue ParseNumber(std::string_view literal);
+std::string NumberToString(const NumberValue& value);
+
+bool IsExact(const NumberValue& value);
+double ToDouble(const NumberValue& value);
+
+// Fixnum operations are overflow-checked and promote to BigInteger. Exact
+// operands are converted to double if the other operand is a flonum.
+NumberValue AddNumbers(const NumberValue& lhs, const NumberValue& rhs);
+NumberValue SubtractNumbers(const NumberValue& lhs, const NumberValue& rhs);
+NumberValue MultiplyNumbers(const NumberValue& lhs, const NumberValue& rhs);
+NumberValue DivideNumbers(const NumberValue& lhs, const NumberValue& rhs);
+NumberValue AbsNumber(const NumberValue& value);
+
+// Compares exactly, NaN is unordered with everything.
+std::partial_ordering CompareNumbers(const NumberValue& lhs, const NumberValue& rhs);
+bool IsZero(const NumberValue& value);
+
+// Equal hashes for values of the same exactness that compare equal.
+size_t HashNumber(const NumberValue& value);
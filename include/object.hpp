@@ -1,5 +1,11 @@
 #pragma once
 
+#include <numeric.hpp>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <typeinfo>
 #include <unordered_set>
 #include <vector>
 
@@ -19,11 +25,19 @@ protected:
     void Mark();
     void Unmark();
 
+    // Walks everything reachable with an explicit stack, so that long lists
+    // do not overflow the call stack.
+    void SetMarkedReachable(bool marked);
+
+    // Objects that reference others without registering them as
+    // dependencies override this to expose them to the collector.
+    virtual void PushReferences(std::vector<Object*>* stack) const;
+
     void AddDependency(Object* dependency);
     void RemoveDependency(Object* dependency);
 
 protected:
-    std::unordered_set<Object*> dependencies_;
+    std::unordered_multiset<Object*> dependencies_;
     bool marked_{false};
 
     friend class Heap;
@@ -31,20 +45,93 @@ protected:
 
 class Number : public Object {
 public:
-    Number(int32_t value);
-    int32_t GetValue() const;
+    Number(NumberValue value);
+    const NumberValue& GetValue() const;
 
 private:
-    int32_t value_;
+    NumberValue value_;
 };
 
+class Function;
+
+struct LambdaInfo;
+
 class Symbol : public Object {
 public:
-    Symbol(std::string symbol);
+    Symbol(std::string symbol, size_t position = 0);
     const std::string& GetName() const;
+    // Offset of the symbol in the query it was read from.
+    size_t GetPosition() const;
+
+    // Inline cache of a call site whose head can only refer to a global
+    // binding. The reader allocates a symbol per occurrence, so the head
+    // symbol identifies the call site.
+    void MarkGlobal();
+    bool IsGlobal() const;
+    Function* GetCachedFunction(uint64_t version) const;
+    void SetCachedFunction(Function* function, uint64_t version);
+
+    // Analysis of the lambda form this symbol introduces, shared by all
+    // closures created from it.
+    const std::shared_ptr<const LambdaInfo>& GetLambdaInfo() const;
+    void SetLambdaInfo(std::shared_ptr<const LambdaInfo> info);
+
+    // Expansion of the macro use this symbol is the head of, valid while
+    // the head refers to the same macro.
+    Object* GetExpansion(const Function* macro) const;
+    void SetExpansion(Function* macro, Object* expansion);
 
 private:
     std::string symbol_;
+    size_t position_;
+    bool global_{false};
+    Function* cached_function_{};
+    uint64_t cached_version_{};
+    std::shared_ptr<const LambdaInfo> lambda_info_;
+    Function* expansion_macro_{};
+    Object* expansion_{};
+};
+
+// Shared binding of a local variable that closures capture and that may
+// change after the capture. Scopes look through boxes, so they are never
+// seen as values.
+class Box : public Object {
+public:
+    Box() = default;
+    Box(Object* value);
+
+    bool IsBound() const;
+    Object* Get() const;
+    void Set(Object* value);
+
+private:
+    Object* value_{};
+    bool bound_{false};
+};
+
+// Immutable string. Short values live inline in std::string. Long
+// concatenations are kept as rope nodes and flattened on first access to
+// the characters, so repeated appends are not quadratic.
+class String : public Object {
+public:
+    String(std::string value);
+    String(String* left, String* right);
+
+    size_t Length() const;
+    const std::string& GetValue();
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override;
+
+private:
+    void Flatten();
+
+private:
+    std::string value_;
+    // Children of an unflattened concatenation.
+    String* left_{};
+    String* right_{};
+    size_t length_;
 };
 
 class Cell : public Object {
@@ -53,11 +140,127 @@ public:
     Object* GetFirst() const;
     Object* GetSecond() const;
 
+    void SetFirst(Object* first);
+    void SetSecond(Object* second);
+
 private:
     Object* first_;
     Object* second_;
 };
 
+// Fixed size array of objects in contiguous storage. Elements are traced
+// directly instead of being registered as dependencies.
+class Vector : public Object {
+public:
+    Vector(std::vector<Object*> elements);
+
+    size_t Size() const;
+    Object* Get(size_t ind) const;
+    void Set(size_t ind, Object* element);
+    void Fill(Object* element);
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override;
+
+private:
+    std::vector<Object*> elements_;
+};
+
+// Byte buffer. The bytes live in their own allocation and hold no
+// references, so the collector neither scans nor moves them.
+class Bytevector : public Object {
+public:
+    Bytevector(std::vector<uint8_t> bytes);
+
+    size_t Size() const;
+    uint8_t* Data();
+
+private:
+    std::vector<uint8_t> bytes_;
+};
+
+// Open-addressing table with linear probing. Keys are compared by value for
+// numbers, symbols and strings and by identity otherwise. Growth allocates
+// a larger table and moves entries into it a few slots per update.
+class HashTable : public Object {
+public:
+    size_t Count() const;
+
+    // Returns nullptr if the key is absent.
+    Object* const* Find(Object* key) const;
+    void Set(Object* key, Object* value);
+    // Returns false if the key is absent.
+    bool Delete(Object* key);
+
+    std::vector<std::pair<Object*, Object*>> GetEntries() const;
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override;
+
+private:
+    struct Table {
+        explicit Table(size_t capacity = 0);
+
+        size_t Capacity() const;
+        // Returns the index of the key or Capacity() if it is absent.
+        size_t Find(Object* key, size_t hash) const;
+        // The key must be absent.
+        void Insert(Object* key, Object* value, size_t hash);
+        void Erase(size_t ind);
+
+        // Empty, deleted, or the high bit and 7 bits of the key hash.
+        std::vector<uint8_t> control;
+        // Key and value of slot i are at 2 * i and 2 * i + 1.
+        std::vector<Object*> slots;
+        // Full and deleted slots.
+        size_t used{0};
+    };
+
+    void Grow();
+    void Migrate(size_t slots_count);
+
+private:
+    Table table_;
+    // Table being drained into table_, slots before migrated_ are moved.
+    Table old_;
+    size_t migrated_{0};
+    size_t count_{0};
+};
+
+// Value of delay, delay-force and make-promise. Once forced it keeps the
+// value and drops its thunk, so that what the thunk referenced, such as the
+// consumed part of a stream, can be collected.
+class Promise : public Object {
+public:
+    // A forced promise.
+    explicit Promise(Object* value);
+    // The thunk of a lazy promise returns another promise to force instead.
+    Promise(Object* thunk, bool is_lazy);
+
+    bool IsForced() const;
+    bool IsLazy() const;
+    Object* GetValue() const;
+    Object* GetThunk() const;
+
+    void SetValue(Object* value);
+    // Takes over the state of the promise a lazy thunk returned and shares
+    // it from then on, so that chains of delay-force are forced in a loop.
+    void Adopt(Promise* other);
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override;
+
+private:
+    struct State {
+        bool forced;
+        bool is_lazy;
+        Object* value;
+        Object* thunk;
+    };
+
+    std::shared_ptr<State> state_;
+};
+
 std::string Serialize(Object* obj);
 
 std::vector<Object*> ObjectToVector(Object* obj);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <object.hpp>
+#include <scope.hpp>
+
+// Rewrites the output of Read before evaluation: folds pure builtin calls on
+// literals, propagates constants bound by define and prunes constant if's.
+Object* Optimize(Object* obj, Scope* global_scope);
@@ -6,3 +6,7 @@
 Object* Read(Tokenizer* tokenizer);
 
 Object* ReadList(Tokenizer* tokenizer);
+
+Object* ReadVector(Tokenizer* tokenizer);
+
+Object* ReadBytevector(Tokenizer* tokenizer);
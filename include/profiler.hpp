@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Samples the stack of lambda calls on SIGPROF and writes the samples as
+// folded stacks: one "outer;inner count" line per distinct stack, the input
+// format of flamegraph tools. Frames are labelled "name@offset" with the
+// define name of the lambda, if any, and the offset of its form in the query.
+class Profiler final {
+public:
+    static constexpr std::chrono::microseconds kDefaultInterval{1000};
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    static Profiler& Instance() {
+        return instance_;
+    }
+
+    void Start(std::chrono::microseconds interval = kDefaultInterval);
+    // Stops sampling and writes the folded stacks to the file.
+    void Stop(const std::string& path);
+
+    bool IsActive() const {
+        return active_;
+    }
+
+    // Labels are interned per run of the profiler.
+    uint64_t GetGeneration() const {
+        return generation_;
+    }
+    uint32_t Intern(std::string label);
+
+    // Calls made while the profiler is active are pushed on its stack.
+    void Enter(uint32_t label) {
+        auto depth = depth_.load(std::memory_order_relaxed);
+        if (depth < stack_.size()) {
+            stack_[depth] = label;
+        }
+        std::atomic_signal_fence(std::memory_order_release);
+        depth_.store(depth + 1, std::memory_order_relaxed);
+    }
+    void Leave() {
+        depth_.store(depth_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+
+    // A suspended generator keeps its calls off the stack and puts them back
+    // on top of the calls of whoever resumes it.
+    size_t GetDepth() const {
+        return depth_.load(std::memory_order_relaxed);
+    }
+    void SaveFrames(size_t base, std::vector<uint32_t>* frames);
+    void RestoreFrames(const std::vector<uint32_t>& frames);
+
+private:
+    Profiler() = default;
+
+    static Profiler instance_;
+
+    static void HandleSignal(int);
+    void TakeSample();
+
+private:
+    bool active_{false};
+    uint64_t generation_{0};
+    std::vector<std::string> labels_;
+    std::unordered_map<std::string, uint32_t> label_ids_;
+
+    // Written by the interpreter and read by the signal handler, which runs
+    // on the same thread.
+    std::vector<uint32_t> stack_;
+    std::atomic<size_t> depth_{0};
+
+    // Samples are stored as the depth followed by the labels, root first.
+    std::vector<uint32_t> samples_;
+    size_t samples_size_{0};
+    size_t dropped_{0};
+};
+
+// Keeps a lambda call on the profiler stack for the duration of the call.
+class ProfiledCall final {
+public:
+    ProfiledCall(const std::string& name, size_t position, uint64_t* generation,
+                 uint32_t* label)
+        : generation_(Profiler::Instance().GetGeneration()) {
+        if (*generation != generation_) {
+            *generation = generation_;
+            *label = Intern(name, position);
+        }
+        Profiler::Instance().Enter(*label);
+    }
+
+    ~ProfiledCall() {
+        auto& profiler = Profiler::Instance();
+        if (profiler.IsActive() && profiler.GetGeneration() == generation_) {
+            profiler.Leave();
+        }
+    }
+
+    ProfiledCall(const ProfiledCall&) = delete;
+    ProfiledCall& operator=(const ProfiledCall&) = delete;
+
+private:
+    static uint32_t Intern(const std::string& name, size_t position);
+
+private:
+    uint64_t generation_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <scheme.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs the queries of many interpreters on a few worker threads. Every
+// interpreter with queries is a tenant of one worker and gets slices of fuel
+// in turn with the other tenants of that worker, so a long query delays each
+// of the others by at most a slice per turn. The queries of an interpreter
+// run one after another on the worker of its tenant.
+class Scheduler final {
+public:
+    static constexpr uint64_t kDefaultSlice = 10000;
+
+    explicit Scheduler(size_t threads, uint64_t slice = kDefaultSlice);
+    // Queries that have not finished are cancelled, their futures report a
+    // broken promise.
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // The interpreter must outlive the query and is not used elsewhere
+    // until it finishes.
+    std::future<std::string> Submit(Interpreter* interpreter, std::string query);
+
+private:
+    struct Query {
+        std::string text;
+        std::promise<std::string> result;
+    };
+
+    struct Tenant {
+        Interpreter* interpreter;
+        size_t worker;
+        std::deque<Query> queries;
+        // Evaluation of the first query, once it has started.
+        std::unique_ptr<Evaluation> evaluation;
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::condition_variable wakeup;
+        std::deque<Tenant*> ready;
+        size_t tenants{0};
+    };
+
+    void Work(size_t ind);
+
+private:
+    uint64_t slice_;
+    std::mutex mutex_;
+    bool stopping_{false};
+    std::unordered_map<Interpreter*, std::unique_ptr<Tenant>> tenants_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+};
@@ -1,16 +1,101 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <string>
 
+class Object;
 class Scope;
+class Heap;
+class Evaluation;
+class ProcedureHandle;
 
 class Interpreter final {
 public:
     Interpreter();
     std::string Run(const std::string&);
 
+    // Evaluation of the query that runs as it is resumed, in slices of fuel.
+    // The interpreter must outlive it and runs no other query until it ends.
+    std::unique_ptr<Evaluation> Start(std::string query);
+
+    // Limit on the number of objects of the interpreter, 0 for none. A query
+    // that needs more once its garbage is collected fails with a
+    // RuntimeError, and the interpreter stays usable.
+    void SetHeapLimit(size_t objects);
+    size_t GetHeapSize() const;
+
+    // Binds a function pointer or a lambda as a global procedure. The types
+    // of its parameters and result, like integers, doubles, bool, strings or
+    // Object*, are deduced and converted. Defined in native.hpp.
+    template <typename F>
+    void RegisterNative(const std::string& name, F func);
+
+    // Handle of the global procedure with the name, for calls from the host
+    // that neither parse nor serialize. The interpreter must outlive it.
+    ProcedureHandle GetProcedure(const std::string& name);
+
     ~Interpreter();
 
 private:
+    // Binds the object made in the heap of the interpreter.
+    void BindGlobal(const std::string& name, const std::function<Object*()>& make);
+
+private:
+    std::unique_ptr<Heap> heap_;
     std::unique_ptr<Scope> global_scope_;
+    bool running_{false};
+    // Objects left by the last collection. Calls from the host collect the
+    // heap once it has grown well past them rather than after every call.
+    size_t live_objects_{0};
+
+    friend class ProcedureHandle;
+};
+
+// Procedure of an interpreter that the host calls directly. It stays alive
+// while the handle exists, even if its name is defined again.
+class ProcedureHandle final {
+public:
+    ProcedureHandle(ProcedureHandle&& other) noexcept;
+    ProcedureHandle& operator=(ProcedureHandle&& other) noexcept;
+    ~ProcedureHandle();
+
+    ProcedureHandle(const ProcedureHandle&) = delete;
+    ProcedureHandle& operator=(const ProcedureHandle&) = delete;
+
+    // Calls the procedure with the arguments converted to objects and
+    // converts its result to R, like native functions do, and throws a
+    // RuntimeError if it is not of that type. R is not a view or an Object*,
+    // those would not outlive the garbage of the call. Defined in
+    // native.hpp.
+    template <typename R, typename... Args>
+    R Call(const Args&... args);
+
+private:
+    friend class Interpreter;
+
+    ProcedureHandle(Interpreter* interpreter, Object* proc, std::string name);
+
+    // Runs a call in the heap of the interpreter, like a query, and collects
+    // the garbage of calls once there is enough of it.
+    class CallScope final {
+    public:
+        explicit CallScope(Interpreter* interpreter);
+        ~CallScope();
+
+        CallScope(const CallScope&) = delete;
+        CallScope& operator=(const CallScope&) = delete;
+
+        Scope* GetGlobalScope() const;
+
+    private:
+        Interpreter* interpreter_;
+        Heap* previous_;
+    };
+
+private:
+    Interpreter* interpreter_;
+    Object* proc_;
+    std::string name_;
 };
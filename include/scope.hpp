@@ -1,25 +1,167 @@
 #pragma once
 
 #include <object.hpp>
+#include <atomic>
+#include <forward_list>
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
-class Function;
+// Bindings of the active lambda calls. Calls return in the reverse order,
+// so their frames share one vector that is reused once it has grown.
+class FrameStack final {
+public:
+    using Slot = std::pair<const std::string*, Object*>;
+
+    FrameStack() = default;
+
+    FrameStack(const FrameStack&) = delete;
+    FrameStack& operator=(const FrameStack&) = delete;
+
+    // Frame stack of the stack of calls that runs on this thread. Generators
+    // and evaluations run on stacks of their own and switch it while they run.
+    static FrameStack& Instance();
+    static void SetInstance(FrameStack* frames);
+
+    size_t Size() const;
+    Slot& operator[](size_t ind);
+    void Push(const std::string* name, Object* obj);
+    void Pop(size_t size);
+
+    // Values that calls in progress hold outside of frames, like evaluated
+    // arguments, so that collections during a query keep them.
+    void Pin(const std::vector<Object*>* objects);
+    void Unpin();
+
+    // Heads and arguments of the calls in progress. They are pushed in
+    // chunks that never move, so a call keeps its arguments in place while
+    // the calls it makes push theirs, and chunks are reused once allocated.
+    // PushArguments pushes those of a call form and sets count to them.
+    Object** PushArguments(Object* form, size_t* count);
+    void PopArguments(size_t count);
+
+    // Values of the frames, pinned ones and arguments.
+    void PushRoots(std::vector<Object*>* roots) const;
+
+private:
+    static constexpr size_t kArgumentsChunk = 1024;
+
+    Object** Reserve(size_t count);
+
+    struct ArgumentsChunk {
+        std::unique_ptr<Object*[]> values;
+        size_t capacity;
+        size_t size;
+    };
+
+    static thread_local FrameStack main_;
+    static thread_local FrameStack* instance_;
+
+    std::vector<Slot> slots_;
+    std::vector<const std::vector<Object*>*> pinned_;
+    // Chunks after the top one are empty, and so is the top one only if it
+    // is the first.
+    std::vector<ArgumentsChunk> chunks_;
+    size_t top_chunk_{0};
+};
+
+// Pins the objects on the frame stack of the thread until the end of the
+// scope.
+class PinnedObjects final {
+public:
+    explicit PinnedObjects(const std::vector<Object*>& objects)
+        : frames_(FrameStack::Instance()) {
+        frames_.Pin(&objects);
+    }
+
+    ~PinnedObjects() {
+        frames_.Unpin();
+    }
+
+    PinnedObjects(const PinnedObjects&) = delete;
+    PinnedObjects& operator=(const PinnedObjects&) = delete;
+
+private:
+    FrameStack& frames_;
+};
+
+// Head and arguments of a call form on the frame stack of the thread until
+// the end of the scope.
+class ArgumentsFrame final {
+public:
+    explicit ArgumentsFrame(Object* form)
+        : begin_(FrameStack::Instance().PushArguments(form, &count_)) {
+    }
+
+    ~ArgumentsFrame() {
+        FrameStack::Instance().PopArguments(count_);
+    }
+
+    ArgumentsFrame(const ArgumentsFrame&) = delete;
+    ArgumentsFrame& operator=(const ArgumentsFrame&) = delete;
+
+    Object** begin() const {  // NOLINT
+        return begin_;
+    }
+
+    Object** end() const {  // NOLINT
+        return begin_ + count_;
+    }
+
+private:
+    size_t count_;
+    Object** begin_;
+};
 
 class Scope final : public Object {
 public:
-    using UnorderedMap = std::unordered_map<std::string, Function*>;
+    using UnorderedMap = std::unordered_map<std::string, Object*>;
     using Iterator = UnorderedMap::iterator;
 
     Scope(Scope* parent_scope = nullptr);
 
-    void PutFunction(std::string name, Function* func);
-    void SetFunction(const std::string& name, Function* func);
-    Function* GetFunction(const std::string& name) const;
+    // Scope of a lambda call, its bindings are kept on the frame stack until
+    // the scope is destroyed. Nothing references call scopes after the call,
+    // closures capture values and boxes, so it lives on the C++ stack.
+    Scope(Scope* parent_scope, FrameStack* frames);
+    ~Scope() override;
+
+    void PutObject(const std::string& name, Object* obj);
+    void SetObject(const std::string& name, Object* obj);
+    Object* GetObject(const std::string& name) const;
+
+    // Binds a name of a call scope that outlives the call without copying it.
+    void PutLocal(const std::string* name, Object* obj);
+
+    // Looks the name up in the scopes below the global one and returns the
+    // box itself for boxed variables.
+    bool FindLocal(const std::string& name, Object** obj) const;
+    Scope* GetGlobalScope();
+
+    // A scope without a parent holds the global bindings.
+    bool IsGlobal() const;
+
+    // Changes whenever a binding of a global scope changes, shared by the
+    // interpreters of all threads.
+    static uint64_t GetGlobalVersion();
 
     Iterator begin();  // NOLINT
     Iterator end();    // NOLINT
 
 private:
+    Object** Find(const std::string& name) const;
+    void OnChange();
+
+private:
+    static std::atomic<uint64_t> global_version_;
+
     Scope* parent_scope_;
     UnorderedMap scope_;
+
+    FrameStack* frames_{};
+    size_t frame_begin_{};
+    size_t frame_end_{};
+    // Names defined in a call scope that its lambda did not declare.
+    std::forward_list<std::string> extra_names_;
 };
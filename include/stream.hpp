@@ -0,0 +1,89 @@
+#pragma once
+
+#include <func.hpp>
+#include <scope.hpp>
+
+// (delay expr) returns a promise to evaluate expr in the scope of the form
+// when it is first forced.
+class Delay : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+// (delay-force expr), where expr returns a promise. Forcing the result forces
+// that promise in the same loop, so a chain of them runs in constant space.
+class DelayForce : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+class MakePromise : public Procedure {
+public:
+    MakePromise();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// Values other than promises are forced to themselves.
+class Force : public Procedure {
+public:
+    Force();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class IsPromise : public Procedure {
+public:
+    IsPromise();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// A stream is () or a pair whose cdr is a promise of a stream.
+// (cons-stream a b) is (cons a (delay b)).
+class ConsStream : public Function {
+public:
+    Object* Execute(FunctionArgs args, Scope* scope) override;
+};
+
+class StreamCar : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+class StreamCdr : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// The stream operations below compute the first pair of their result and
+// leave the rest to a promise that references only the rest of the source.
+// Lists are accepted as streams that are already forced.
+
+// (stream-map proc stream...)
+class StreamMap : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// (stream-filter pred stream)
+class StreamFilter : public Procedure {
+public:
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// (stream-take count stream)
+class StreamTake : public Procedure {
+public:
+    StreamTake();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
+
+// (stream->list [count] stream) forces a finite stream into a list.
+class StreamToList : public Procedure {
+public:
+    StreamToList();
+
+    Object* Call(FunctionArgs args, Scope* scope) override;
+};
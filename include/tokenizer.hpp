@@ -1,5 +1,8 @@
 #pragma once
 
+#include <numeric.hpp>
+#include <cstdint>
+#include <string>
 #include <variant>
 #include <istream>
 
@@ -25,14 +28,32 @@ struct CloseBracketToken {
     bool operator==(const CloseBracketToken&) const;
 };
 
+// The opening "#(" of a vector literal.
+struct VectorOpenBracketToken {
+    bool operator==(const VectorOpenBracketToken&) const;
+};
+
+// The opening "#u8(" of a bytevector literal.
+struct BytevectorOpenBracketToken {
+    bool operator==(const BytevectorOpenBracketToken&) const;
+};
+
+// Contents of a string literal with escapes already resolved.
+struct StringToken {
+    std::string value;
+
+    bool operator==(const StringToken& other) const;
+};
+
 struct ConstantToken {
-    int32_t value;
+    NumberValue value;
 
     bool operator==(const ConstantToken& other) const;
 };
 
 using Token = std::variant<ConstantToken, OpenBracketToken, CloseBracketToken, SymbolToken,
-                           QuoteToken, DotToken>;
+                           QuoteToken, DotToken, VectorOpenBracketToken, StringToken,
+                           BytevectorOpenBracketToken>;
 
 class Tokenizer final {
 public:
@@ -41,9 +62,12 @@ public:
     bool IsEnd() const;
     void Next();
     Token GetToken() const;
+    // Offset of the current token in the stream.
+    size_t GetPosition() const;
 
 private:
     std::istream* istream_;
     Token token_;
+    size_t position_{0};
     bool eof_;
 };
@@ -1,16 +1,71 @@
 #include <scheme.hpp>
+#include <profiler.hpp>
+#include <instrumentation.hpp>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <exception>
+#include <string_view>
+
+// Usage: scheme [--profile <file>] [--profile-interval <microseconds>]
+//               [--counters <file>] [--trace <file>]
+// Counters and traces need a build with SCHEME_INSTRUMENTATION.
+int main(int argc, char** argv) {
+    std::string profile_path;
+    std::string counters_path;
+    std::string trace_path;
+    auto profile_interval = Profiler::kDefaultInterval;
+    for (int ind = 1; ind < argc; ind += 2) {
+        if (ind + 1 == argc) {
+            std::cerr << "Missing value of " << argv[ind] << "\n";
+            return 1;
+        }
+        if (std::string_view(argv[ind]) == "--profile") {
+            profile_path = argv[ind + 1];
+        } else if (std::string_view(argv[ind]) == "--profile-interval") {
+            profile_interval = std::chrono::microseconds(std::strtoll(argv[ind + 1], nullptr, 10));
+        } else if (std::string_view(argv[ind]) == "--counters") {
+            counters_path = argv[ind + 1];
+        } else if (std::string_view(argv[ind]) == "--trace") {
+            trace_path = argv[ind + 1];
+        } else {
+            std::cerr << "Unknown option: " << argv[ind] << "\n";
+            return 1;
+        }
+    }
+    if (!kInstrumentationEnabled && (!counters_path.empty() || !trace_path.empty())) {
+        std::cerr << "Built without SCHEME_INSTRUMENTATION\n";
+        return 1;
+    }
 
-int main() {
     try {
         std::string query;
         std::getline(std::cin, query);
         Interpreter interpreter{};
+        if (!profile_path.empty()) {
+            Profiler::Instance().Start(profile_interval);
+        }
         auto result = interpreter.Run(query);
         std::cout << result << std::endl;
 
     } catch (const std::exception& ex) {
         std::cout << ex.what() << "\n";
     }
+
+    if (!profile_path.empty() && Profiler::Instance().IsActive()) {
+        try {
+            Profiler::Instance().Stop(profile_path);
+        } catch (const std::exception& ex) {
+            std::cerr << ex.what() << "\n";
+            return 1;
+        }
+    }
+    if (!counters_path.empty()) {
+        std::ofstream out(counters_path);
+        Instrumentation::Instance().WriteCounters(&out);
+    }
+    if (!trace_path.empty()) {
+        std::ofstream out(trace_path);
+        Instrumentation::Instance().WriteTrace(&out);
+    }
 }
@@ -0,0 +1,114 @@
+#include <bytes.hpp>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+constexpr size_t kBlockSize = 16;
+
+void FillBytesScalar(uint8_t* data, size_t size, uint8_t value) {
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = value;
+    }
+}
+
+int CompareBytesScalar(const uint8_t* lhs, const uint8_t* rhs, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (lhs[i] != rhs[i]) {
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+bool MatchesAt(const uint8_t* haystack, const uint8_t* needle, size_t needle_size) {
+    return CompareBytesScalar(haystack, needle, needle_size) == 0;
+}
+
+size_t FindBytesScalar(const uint8_t* haystack, size_t haystack_size, const uint8_t* needle,
+                       size_t needle_size, size_t start) {
+    for (size_t i = start; i + needle_size <= haystack_size; ++i) {
+        if (haystack[i] == needle[0] && MatchesAt(haystack + i, needle, needle_size)) {
+            return i;
+        }
+    }
+    return haystack_size;
+}
+}  // namespace
+
+#if defined(__SSE2__)
+
+void FillBytes(uint8_t* data, size_t size, uint8_t value) {
+    auto block = _mm_set1_epi8(static_cast<char>(value));
+    size_t i = 0;
+    for (; i + kBlockSize <= size; i += kBlockSize) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), block);
+    }
+    FillBytesScalar(data + i, size - i, value);
+}
+
+int CompareBytes(const uint8_t* lhs, const uint8_t* rhs, size_t size) {
+    size_t i = 0;
+    for (; i + kBlockSize <= size; i += kBlockSize) {
+        auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+        auto equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+        if (equal != 0xffff) {
+            auto ind = i + std::countr_one(equal);
+            return lhs[ind] < rhs[ind] ? -1 : 1;
+        }
+    }
+    return CompareBytesScalar(lhs + i, rhs + i, size - i);
+}
+
+// Checks 16 candidate offsets at once by comparing both the first and the
+// last byte of the needle, only the survivors are compared in full.
+size_t FindBytes(const uint8_t* haystack, size_t haystack_size, const uint8_t* needle,
+                 size_t needle_size) {
+    if (needle_size == 0) {
+        return 0;
+    }
+    if (needle_size > haystack_size) {
+        return haystack_size;
+    }
+    auto first = _mm_set1_epi8(static_cast<char>(needle[0]));
+    auto last = _mm_set1_epi8(static_cast<char>(needle[needle_size - 1]));
+    size_t i = 0;
+    for (; i + needle_size - 1 + kBlockSize <= haystack_size; i += kBlockSize) {
+        auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+        auto block_last =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + needle_size - 1));
+        auto candidates = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))));
+        while (candidates != 0) {
+            auto offset = i + std::countr_zero(candidates);
+            if (MatchesAt(haystack + offset, needle, needle_size)) {
+                return offset;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return FindBytesScalar(haystack, haystack_size, needle, needle_size, i);
+}
+
+#else
+
+void FillBytes(uint8_t* data, size_t size, uint8_t value) {
+    FillBytesScalar(data, size, value);
+}
+
+int CompareBytes(const uint8_t* lhs, const uint8_t* rhs, size_t size) {
+    return CompareBytesScalar(lhs, rhs, size);
+}
+
+size_t FindBytes(const uint8_t* haystack, size_t haystack_size, const uint8_t* needle,
+                 size_t needle_size) {
+    if (needle_size == 0) {
+        return 0;
+    }
+    return FindBytesScalar(haystack, haystack_size, needle, needle_size, 0);
+}
+
+#endif
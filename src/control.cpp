@@ -0,0 +1,487 @@
+#include <control.hpp>
+#include <error.hpp>
+#include <garbage_collection.hpp>
+#include <profiler.hpp>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#define SCHEME_SANITIZE_FIBERS
+#endif
+
+namespace {
+// Reserved, not committed: pages are backed once the generator touches them.
+constexpr size_t kStackSize = 8 << 20;
+constexpr size_t kPooledStacks = 16;
+
+// Stacks of finished fibers are reused, mapping one takes system calls.
+std::mutex stack_pool_mutex;
+std::vector<void*> stack_pool;
+
+// The lowest page is a guard, so that an overflow faults instead of
+// overwriting other memory.
+void* AllocateStack() {
+    {
+        std::lock_guard lock(stack_pool_mutex);
+        if (!stack_pool.empty()) {
+            auto stack = stack_pool.back();
+            stack_pool.pop_back();
+            return stack;
+        }
+    }
+    auto stack = mmap(nullptr, kStackSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    ThrowRuntimeErrorIf(stack == MAP_FAILED, "Cannot allocate a stack");
+    mprotect(stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+    return stack;
+}
+
+void FreeStack(void* stack) {
+    std::lock_guard lock(stack_pool_mutex);
+    if (stack_pool.size() < kPooledStacks) {
+        stack_pool.push_back(stack);
+    } else {
+        munmap(stack, kStackSize);
+    }
+}
+
+// AddressSanitizer tracks the stack in use, so it is told about switches.
+void StartSwitch(void** fake_stack, const void* bottom, size_t size) {
+#ifdef SCHEME_SANITIZE_FIBERS
+    __sanitizer_start_switch_fiber(fake_stack, bottom, size);
+#else
+    (void)fake_stack, (void)bottom, (void)size;
+#endif
+}
+
+void FinishSwitch(void* fake_stack, const void** bottom, size_t* size) {
+#ifdef SCHEME_SANITIZE_FIBERS
+    __sanitizer_finish_switch_fiber(fake_stack, bottom, size);
+#else
+    (void)fake_stack, (void)bottom, (void)size;
+#endif
+}
+
+// Top of the stack the thread started on, the one it runs when no fiber does.
+const void* GetThreadStackTop() {
+    static thread_local const void* top = [] {
+        pthread_attr_t attr;
+        void* addr = nullptr;
+        size_t size = 0;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            pthread_attr_getstack(&attr, &addr, &size);
+            pthread_attr_destroy(&attr);
+        }
+        return static_cast<const void*>(static_cast<const char*>(addr) + size);
+    }();
+    return top;
+}
+
+// Reads the aligned words of a stack in use, redzones of locals included, so
+// AddressSanitizer must not check the reads.
+__attribute__((no_sanitize_address)) void PushWords(const void* begin, const void* end,
+                                                    std::vector<const void*>* words) {
+    auto address = reinterpret_cast<uintptr_t>(begin);
+    address = (address + alignof(void*) - 1) & ~(alignof(void*) - 1);
+    for (; address + sizeof(void*) <= reinterpret_cast<uintptr_t>(end);
+         address += sizeof(void*)) {
+        const void* word = *reinterpret_cast<const void* const*>(address);
+        words->push_back(word);
+    }
+}
+
+// Thrown by a continuation and caught by the call/cc that created it. It
+// is not a std::exception, so error handlers do not see it.
+struct ContinuationInvoked {
+    Continuation* continuation;
+    Object* value;
+};
+
+// Unwind the stacks of generators and evaluations that are never resumed
+// again.
+struct GeneratorCancelled {};
+struct EvaluationCancelled {};
+
+class ExtentGuard {
+public:
+    explicit ExtentGuard(Continuation* continuation) : continuation_(continuation) {
+    }
+
+    ~ExtentGuard() {
+        continuation_->EndExtent();
+    }
+
+    ExtentGuard(const ExtentGuard&) = delete;
+    ExtentGuard& operator=(const ExtentGuard&) = delete;
+
+private:
+    Continuation* continuation_;
+};
+
+Object* GetOptionalValue(const FunctionArgs& args, std::string_view msg) {
+    ThrowRuntimeErrorIf(args.Size() > 1, msg);
+    return args.Size() == 1 ? args[0] : nullptr;
+}
+}  // namespace
+
+Object* CallWithCurrentContinuation::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(args.Size() != 1 || !As<Procedure>(args[0]),
+                        "call/cc: expected a procedure");
+    auto proc = As<Procedure>(args[0]);
+    auto continuation =
+        As<Continuation>(Heap::Instance().Make<Continuation>(Generator::Current()));
+
+    ExtentGuard guard(continuation);
+    std::vector<Object*> proc_args{continuation};
+    try {
+        return proc->Invoke(FunctionArgs(proc_args), scope);
+    } catch (const ContinuationInvoked& invoked) {
+        if (invoked.continuation != continuation) {
+            throw;
+        }
+        return invoked.value;
+    }
+}
+
+Continuation::Continuation(Generator* generator) : generator_(generator) {
+    AddDependency(generator_);
+}
+
+Object* Continuation::Call(FunctionArgs args, Scope*) {
+    auto value = GetOptionalValue(args, "continuation: expected at most 1 argument");
+    ThrowRuntimeErrorIf(!active_, "continuation: call/cc has already returned");
+
+    // The call/cc must be on the stack of calls that runs now, or on one of
+    // the stacks that resumed it, which an exception reaches through them.
+    auto generator = Generator::Current();
+    while (generator != generator_ && generator) {
+        generator = generator->GetResumer();
+    }
+    ThrowRuntimeErrorIf(generator != generator_,
+                        "continuation: its generator is not running");
+    throw ContinuationInvoked{this, value};
+}
+
+void Continuation::EndExtent() {
+    active_ = false;
+}
+
+thread_local Fiber* Fiber::current_ = nullptr;
+
+Fiber::Fiber(std::function<void()> body, Generator* generator)
+    : body_(std::move(body)), context_{this, &frames_, &Heap::Instance(), generator} {
+}
+
+Fiber::~Fiber() {
+    if (stack_) {
+        FreeStack(stack_);
+    }
+}
+
+Fiber::Context Fiber::GetContext() {
+    return {current_, &FrameStack::Instance(), &Heap::Instance(), Generator::current_};
+}
+
+void Fiber::SetContext(const Context& context) {
+    current_ = context.fiber;
+    FrameStack::SetInstance(context.frames);
+    Heap::SetInstance(context.heap);
+    Generator::current_ = context.generator;
+}
+
+// The context of the caller is saved and restored here, on the stack of the
+// caller, so that it never depends on which thread resumed a suspension.
+void Fiber::Resume() {
+    if (!stack_) {
+        stack_ = AllocateStack();
+        getcontext(&fiber_context_);
+        fiber_context_.uc_stack.ss_sp = stack_;
+        fiber_context_.uc_stack.ss_size = kStackSize;
+        fiber_context_.uc_link = &caller_context_;
+        makecontext(&fiber_context_, &Fiber::Run, 0);
+    }
+
+    auto& profiler = Profiler::Instance();
+    auto profiled = profiler.IsActive();
+    auto generation = profiler.GetGeneration();
+    if (profiled) {
+        profile_base_ = profiler.GetDepth();
+        if (profile_generation_ == generation) {
+            profiler.RestoreFrames(profile_frames_);
+        }
+    }
+
+    auto caller = GetContext();
+    caller_ = caller;
+    SetContext(context_);
+    void* fake_stack = nullptr;
+    caller_stack_pointer_ = &fake_stack;
+    StartSwitch(&fake_stack, context_.fiber->stack_, kStackSize);
+    swapcontext(&caller_context_, &fiber_context_);
+    FinishSwitch(fake_stack, nullptr, nullptr);
+    context_ = GetContext();
+    SetContext(caller);
+
+    profile_frames_.clear();
+    if (profiled && profiler.IsActive() && profiler.GetGeneration() == generation) {
+        profiler.SaveFrames(profile_base_, &profile_frames_);
+        profile_generation_ = generation;
+    }
+
+    if (finished_) {
+        FreeStack(std::exchange(stack_, nullptr));
+    }
+}
+
+void Fiber::Suspend() {
+    void* fake_stack = nullptr;
+    stack_pointer_ = &fake_stack;
+    StartSwitch(&fake_stack, caller_stack_, caller_stack_size_);
+    swapcontext(&fiber_context_, &caller_context_);
+    FinishSwitch(fake_stack, &caller_stack_, &caller_stack_size_);
+}
+
+bool Fiber::IsStarted() const {
+    return stack_ || finished_;
+}
+
+bool Fiber::IsFinished() const {
+    return finished_;
+}
+
+// Registers are saved on the stack first, so that the words cover them.
+void Fiber::FindRunningRoots(std::vector<Object*>* roots, std::vector<const void*>* words) {
+    ucontext_t registers;
+    getcontext(&registers);
+    const void* stack_pointer = &registers;
+    FrameStack::Instance().PushRoots(roots);
+    for (auto fiber = current_; fiber; fiber = fiber->caller_.fiber) {
+        PushWords(stack_pointer, static_cast<char*>(fiber->stack_) + kStackSize, words);
+        PushWords(&fiber->caller_context_, &fiber->caller_context_ + 1, words);
+        fiber->caller_.frames->PushRoots(roots);
+        stack_pointer = fiber->caller_stack_pointer_;
+    }
+    PushWords(stack_pointer, GetThreadStackTop(), words);
+}
+
+void Fiber::FindSuspendedRoots(std::vector<Object*>* roots,
+                               std::vector<const void*>* words) const {
+    PushWords(stack_pointer_, static_cast<char*>(stack_) + kStackSize, words);
+    PushWords(&fiber_context_, &fiber_context_ + 1, words);
+    context_.frames->PushRoots(roots);
+}
+
+void Fiber::Run() {
+    auto fiber = current_;
+    FinishSwitch(nullptr, &fiber->caller_stack_, &fiber->caller_stack_size_);
+    fiber->body_();
+    fiber->finished_ = true;
+    StartSwitch(nullptr, fiber->caller_stack_, fiber->caller_stack_size_);
+}
+
+Object* MakeGenerator::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(args.Size() != 1 || !As<Procedure>(args[0]),
+                        "make-generator: expected a procedure");
+    return Heap::Instance().Make<Generator>(As<Procedure>(args[0]), scope->GetGlobalScope());
+}
+
+Object* IsGeneratorDone::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(args.Size() != 1 || !Is<Generator>(args[0]),
+                        "generator-done?: expected a generator");
+    return scope->GetObject(As<Generator>(args[0])->IsDone() ? "#t" : "#f");
+}
+
+thread_local Generator* Generator::current_ = nullptr;
+std::mutex Generator::suspended_mutex_;
+std::unordered_set<Generator*> Generator::suspended_;
+
+Generator::Generator(Procedure* proc, Scope* global_scope)
+    : proc_(proc),
+      yield_(Heap::Instance().Make<GeneratorYield>(this)),
+      global_scope_(global_scope),
+      heap_(&Heap::Instance()),
+      fiber_([this] { Run(); }, this) {
+    AddDependency(proc_);
+    AddDependency(yield_);
+}
+
+Generator::~Generator() {
+    if (state_ == State::kSuspended) {
+        cancelled_ = true;
+        Resume(nullptr);
+    }
+}
+
+Object* Generator::Call(FunctionArgs args, Scope*) {
+    return Resume(GetOptionalValue(args, "generator: expected at most 1 argument"));
+}
+
+Object* Generator::Resume(Object* value) {
+    ThrowRuntimeErrorIf(state_ == State::kRunning, "generator: already running");
+    ThrowRuntimeErrorIf(state_ == State::kDone, "generator: already finished");
+
+    {
+        std::lock_guard lock(suspended_mutex_);
+        suspended_.erase(this);
+    }
+    resumer_ = current_;
+    state_ = State::kRunning;
+    transfer_ = value;
+    fiber_.Resume();
+    resumer_ = nullptr;
+
+    if (state_ == State::kDone) {
+        if (exception_) {
+            std::rethrow_exception(std::exchange(exception_, nullptr));
+        }
+    } else {
+        std::lock_guard lock(suspended_mutex_);
+        suspended_.insert(this);
+    }
+    return transfer_;
+}
+
+Object* Generator::Yield(Object* value) {
+    ThrowRuntimeErrorIf(current_ != this, "yield: its generator is not running");
+    transfer_ = value;
+    state_ = State::kSuspended;
+    fiber_.Suspend();
+    if (cancelled_) {
+        throw GeneratorCancelled{};
+    }
+    return transfer_;
+}
+
+// Exceptions cannot leave the fiber, so they are passed to the caller, which
+// rethrows them on its own stack.
+void Generator::Run() {
+    try {
+        std::vector<Object*> args{yield_};
+        transfer_ = proc_->Invoke(FunctionArgs(args), global_scope_);
+    } catch (const GeneratorCancelled&) {
+        transfer_ = nullptr;
+    } catch (...) {
+        exception_ = std::current_exception();
+    }
+    state_ = State::kDone;
+}
+
+bool Generator::IsDone() const {
+    return state_ == State::kDone;
+}
+
+Generator* Generator::Current() {
+    return current_;
+}
+
+Generator* Generator::GetResumer() const {
+    return resumer_;
+}
+
+bool Generator::PrepareSweep(const Heap* heap) {
+    std::vector<Generator*> garbage;
+    {
+        std::lock_guard lock(suspended_mutex_);
+        for (auto generator : suspended_) {
+            if (generator->heap_ != heap) {
+                continue;
+            }
+            if (generator->marked_) {
+                return false;
+            }
+            garbage.push_back(generator);
+        }
+    }
+    for (auto generator : garbage) {
+        generator->cancelled_ = true;
+        generator->Resume(nullptr);
+    }
+    return true;
+}
+
+void Generator::FindRoots(const Heap* heap, std::vector<Object*>* roots,
+                          std::vector<const void*>* words) {
+    Fiber::FindRunningRoots(roots, words);
+    std::lock_guard lock(suspended_mutex_);
+    for (auto generator : suspended_) {
+        if (generator->heap_ == heap) {
+            roots->push_back(generator);
+            generator->fiber_.FindSuspendedRoots(roots, words);
+        }
+    }
+}
+
+GeneratorYield::GeneratorYield(Generator* generator) : generator_(generator) {
+    AddDependency(generator_);
+}
+
+Object* GeneratorYield::Call(FunctionArgs args, Scope*) {
+    return generator_->Yield(GetOptionalValue(args, "yield: expected at most 1 argument"));
+}
+
+thread_local uint64_t Fuel::remaining_ = UINT64_MAX;
+
+void Fuel::Exhaust() {
+    auto evaluation = Evaluation::current_;
+    if (!evaluation) {
+        remaining_ = UINT64_MAX;
+        return;
+    }
+    evaluation->fiber_.Suspend();
+    if (evaluation->cancelled_) {
+        throw EvaluationCancelled{};
+    }
+}
+
+thread_local Evaluation* Evaluation::current_ = nullptr;
+
+Evaluation::Evaluation(std::function<std::string()> body)
+    : body_(std::move(body)), fiber_([this] { Run(); }, nullptr) {
+}
+
+Evaluation::~Evaluation() {
+    if (fiber_.IsStarted() && !fiber_.IsFinished()) {
+        cancelled_ = true;
+        Resume(1);
+    }
+}
+
+bool Evaluation::Resume(uint64_t fuel) {
+    if (fiber_.IsFinished()) {
+        return true;
+    }
+    auto previous = std::exchange(current_, this);
+    auto previous_fuel = std::exchange(Fuel::remaining_, std::max<uint64_t>(fuel, 1));
+    fiber_.Resume();
+    fuel_used_ += std::max<uint64_t>(fuel, 1) - Fuel::remaining_;
+    Fuel::remaining_ = previous_fuel;
+    current_ = previous;
+    return fiber_.IsFinished();
+}
+
+bool Evaluation::IsDone() const {
+    return fiber_.IsFinished();
+}
+
+uint64_t Evaluation::GetFuelUsed() const {
+    return fuel_used_;
+}
+
+std::string Evaluation::GetResult() const {
+    ThrowRuntimeErrorIf(!fiber_.IsFinished(), "Evaluation has not finished");
+    if (exception_) {
+        std::rethrow_exception(exception_);
+    }
+    return result_;
+}
+
+void Evaluation::Run() {
+    try {
+        result_ = body_();
+    } catch (const EvaluationCancelled&) {
+    } catch (...) {
+        exception_ = std::current_exception();
+    }
+}
@@ -2,632 +2,1828 @@
 #include <error.hpp>
 #include <garbage_collection.hpp>
 #include <scope.hpp>
+#include <bytes.hpp>
+#include <jit.hpp>
+#include <profiler.hpp>
+#include <instrumentation.hpp>
+#include <control.hpp>
+#include <cstring>
+#include <optional>
+#include <unordered_set>
 
 namespace {
-Function* ExtractFunctionAndExecute(Object* obj, Scope* scope);
+Function* ToFunction(Object* obj) {
+    auto func = As<Function>(obj);
+    ThrowRuntimeErrorIf(!func, "Expected a procedure");
+    return func;
+}
+
+Function* ExtractFunction(Object* head, Scope* scope) {
+    if (!Is<Symbol>(head) || !As<Symbol>(head)->IsGlobal()) {
+        return ToFunction(Process(head, scope));
+    }
+    auto symbol = As<Symbol>(head);
+    auto version = Scope::GetGlobalVersion();
+    if (auto func = symbol->GetCachedFunction(version)) {
+        if constexpr (kInstrumentationEnabled) {
+            Instrumentation::Instance().CountInlineCacheHit();
+        }
+        return func;
+    }
+    auto func = ToFunction(scope->GetObject(symbol->GetName()));
+    symbol->SetCachedFunction(func, version);
+    return func;
+}
+
+void ProcessArgs(FunctionArgs& args, Scope* scope) {
+    for (auto& arg : args) {
+        arg = Process(arg, scope);
+    }
+}
 
-Function* ExtractFunction(Object* obj, Scope* scope) {
-    if (Is<Number>(obj)) {
-        return As<Function>(Heap::Instance().Make<ObjectHolder>(obj, scope));
+// Negative and big indices are mapped to SIZE_MAX to be always out of range.
+size_t ToIndex(Number* number) {
+    auto value = std::get_if<int64_t>(&number->GetValue());
+    return value && *value >= 0 ? *value : SIZE_MAX;
+}
 
-    } else if (Is<Cell>(obj)) {
-        return ExtractFunctionAndExecute(obj, scope);
+uint8_t ToByte(Object* obj, std::string_view msg) {
+    auto value = Is<Number>(obj) ? std::get_if<int64_t>(&As<Number>(obj)->GetValue()) : nullptr;
+    ThrowRuntimeErrorIf(!value || *value < 0 || *value > 255, msg);
+    return static_cast<uint8_t>(*value);
+}
 
-    } else if (Is<Symbol>(obj)) {
-        const auto& name = As<Symbol>(obj)->GetName();
-        return scope->GetFunction(name);
+// Reads the optional [start [end]] arguments at args[ind] of a range within
+// a buffer of the given size.
+std::pair<size_t, size_t> ToRange(const FunctionArgs& args, size_t ind, size_t size,
+                                  std::string_view msg) {
+    size_t bounds[] = {0, size};
+    for (size_t i = 0; i < 2 && ind + i < args.Size(); ++i) {
+        ThrowRuntimeErrorIf(!Is<Number>(args[ind + i]), msg);
+        bounds[i] = ToIndex(As<Number>(args[ind + i]));
     }
-    throw RuntimeError("Unexpected function");
+    ThrowRuntimeErrorIf(bounds[0] > bounds[1] || bounds[1] > size, msg);
+    return {bounds[0], bounds[1]};
 }
 
-Object* ExtractResult(Function* func) {
-    if (!func) {
-        return nullptr;
+// The result of max and min is inexact if any of the arguments is.
+Object* ToInexactIfAny(Number* result, const FunctionArgs& args) {
+    if (!IsExact(result->GetValue())) {
+        return result;
+    }
+    for (auto arg : args) {
+        if (!IsExact(As<Number>(arg)->GetValue())) {
+            return Heap::Instance().Make<Number>(ToDouble(result->GetValue()));
+        }
     }
-    if (Is<ObjectHolder>(func)) {
-        return As<ObjectHolder>(func)->GetObject();
+    return result;
+}
+
+Procedure* ToProcedure(Object* obj, std::string_view msg) {
+    auto proc = As<Procedure>(obj);
+    ThrowRuntimeErrorIf(!proc, msg);
+    return proc;
+}
+
+// Follows cdr up to count times, stops early at the end of the list.
+Object* SkipCells(Object* obj, size_t count) {
+    for (; count != 0 && Is<Cell>(obj); --count) {
+        obj = As<Cell>(obj)->GetSecond();
     }
-    throw RuntimeError("Unexpected result");
+    return count == 0 ? obj : nullptr;
 }
 
-void ProcessArgs(FunctionArgs& args, Scope* scope) {
-    for (auto& arg : args) {
-        arg = Process(arg, scope);
+// Finite list ending with (), cycles are detected with two pointers.
+bool IsProperList(Object* obj) {
+    auto slow = obj;
+    while (Is<Cell>(obj)) {
+        obj = As<Cell>(obj)->GetSecond();
+        if (!Is<Cell>(obj)) {
+            break;
+        }
+        obj = As<Cell>(obj)->GetSecond();
+        slow = As<Cell>(slow)->GetSecond();
+        if (obj == slow) {
+            return false;
+        }
+    }
+    return obj == nullptr;
+}
+
+bool AreEqual(Object* lhs, Object* rhs) {
+    while (lhs != rhs) {
+        if (Is<Number>(lhs) && Is<Number>(rhs)) {
+            const auto& a = As<Number>(lhs)->GetValue();
+            const auto& b = As<Number>(rhs)->GetValue();
+            return IsExact(a) == IsExact(b) && CompareNumbers(a, b) == 0;
+        }
+        if (Is<Symbol>(lhs) && Is<Symbol>(rhs)) {
+            return As<Symbol>(lhs)->GetName() == As<Symbol>(rhs)->GetName();
+        }
+        if (Is<String>(lhs) && Is<String>(rhs)) {
+            return As<String>(lhs)->GetValue() == As<String>(rhs)->GetValue();
+        }
+        if (Is<Vector>(lhs) && Is<Vector>(rhs)) {
+            auto a = As<Vector>(lhs);
+            auto b = As<Vector>(rhs);
+            if (a->Size() != b->Size()) {
+                return false;
+            }
+            for (size_t i = 0, size = a->Size(); i < size; ++i) {
+                if (!AreEqual(a->Get(i), b->Get(i))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (!Is<Cell>(lhs) || !Is<Cell>(rhs) ||
+            !AreEqual(As<Cell>(lhs)->GetFirst(), As<Cell>(rhs)->GetFirst())) {
+            return false;
+        }
+        lhs = As<Cell>(lhs)->GetSecond();
+        rhs = As<Cell>(rhs)->GetSecond();
+    }
+    return true;
+}
+
+// Concatenations up to this length are copied, longer ones become ropes.
+constexpr size_t kFlatConcatenationLimit = 256;
+
+String* Concatenate(String* lhs, String* rhs) {
+    if (rhs->Length() == 0) {
+        return lhs;
+    }
+    if (lhs->Length() == 0) {
+        return rhs;
+    }
+    auto& heap = Heap::Instance();
+    if (lhs->Length() + rhs->Length() <= kFlatConcatenationLimit) {
+        return As<String>(heap.Make<String>(lhs->GetValue() + rhs->GetValue()));
     }
+    return As<String>(heap.Make<String>(lhs, rhs));
 }
 
-Function* ExtractFunctionAndExecute(Object* obj, Scope* scope) {
-    auto vector_args = ObjectToVector(obj);
-    auto func = ExtractFunction(vector_args[0], scope);
+// Builds a list front to back by appending to its last cell.
+class ListBuilder {
+public:
+    void Append(Object* obj) {
+        auto cell = As<Cell>(Heap::Instance().Make<Cell>(obj, nullptr));
+        if (last_) {
+            last_->SetSecond(cell);
+        } else {
+            head_ = cell;
+        }
+        last_ = cell;
+    }
+
+    Object* Finish(Object* tail = nullptr) {
+        if (!last_) {
+            return tail;
+        }
+        last_->SetSecond(tail);
+        return head_;
+    }
+
+private:
+    Object* head_{};
+    Cell* last_{};
+};
+
+// Walks several lists in parallel and exposes the current elements as
+// arguments of a call, optionally preceded by reserved slots.
+class ListWalker {
+public:
+    ListWalker(FunctionArgs::Iterator begin, FunctionArgs::Iterator end, size_t reserved = 0)
+        : lists_(begin, end), args_(reserved + lists_.size()), reserved_(reserved) {
+    }
+
+    // Advances to the next elements, returns false once any list ends.
+    bool Next() {
+        for (auto list : lists_) {
+            if (!Is<Cell>(list)) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < lists_.size(); ++i) {
+            args_[reserved_ + i] = As<Cell>(lists_[i])->GetFirst();
+            lists_[i] = As<Cell>(lists_[i])->GetSecond();
+        }
+        return true;
+    }
+
+    FunctionArgs GetArgs() {
+        return FunctionArgs(args_);
+    }
+
+    // Reports lists that ended with something other than ().
+    void Check(std::string_view msg) const {
+        for (auto list : lists_) {
+            ThrowRuntimeErrorIf(list != nullptr && !Is<Cell>(list), msg);
+        }
+    }
 
-    auto args_begin = vector_args.begin() + 1;
-    auto args_end = vector_args.end();
-    auto func_args = FunctionArgs(args_begin, args_end);
+private:
+    std::vector<Object*> lists_;
+    std::vector<Object*> args_;
+    size_t reserved_;
+};
 
-    auto res = As<Function>(func)->Execute(std::move(func_args), scope);
-    return As<Function>(res);
+bool IsFalse(Object* obj) {
+    return Is<Symbol>(obj) && As<Symbol>(obj)->GetName() == "#f";
 }
 
-Function* GetTrueFunction(Scope* scope) {
-    return scope->GetFunction("#t");
+Object* GetTrue(Scope* scope) {
+    return scope->GetObject("#t");
 }
 
-Function* GetFalseFunction(Scope* scope) {
-    return scope->GetFunction("#f");
+Object* GetFalse(Scope* scope) {
+    return scope->GetObject("#f");
 }
-}  // namespace
 
-Object* Process(Object* obj, Scope* scope) {
-    auto res = ExtractFunctionAndExecute(obj, scope);
-    return ExtractResult(res);
+using Names = std::unordered_set<std::string>;
+
+bool IsNamed(Object* obj, std::string_view name) {
+    return Is<Symbol>(obj) && As<Symbol>(obj)->GetName() == name;
 }
 
-FunctionArgs::FunctionArgs(Iterator begin, Iterator end) : begin_(begin), end_(end) {
+// Collects every symbol outside of quotes. Names bound by nested lambdas are
+// kept too: capturing a variable that turns out to be shadowed is harmless.
+void CollectSymbols(Object* obj, Names* names) {
+    if (Is<Symbol>(obj)) {
+        names->insert(As<Symbol>(obj)->GetName());
+        return;
+    }
+    if (!Is<Cell>(obj) || IsNamed(As<Cell>(obj)->GetFirst(), "quote")) {
+        return;
+    }
+    for (; Is<Cell>(obj); obj = As<Cell>(obj)->GetSecond()) {
+        CollectSymbols(As<Cell>(obj)->GetFirst(), names);
+    }
 }
 
-Object* FunctionArgs::operator[](size_t ind) const {
-    return begin_[ind];
+// Collects targets of the defines evaluated in the frame of the lambda, so
+// it skips quotes and the bodies of nested lambdas.
+void CollectDefines(Object* obj, Names* names) {
+    if (!Is<Cell>(obj)) {
+        return;
+    }
+    auto head = As<Cell>(obj)->GetFirst();
+    if (IsNamed(head, "quote") || IsNamed(head, "lambda") || IsNamed(head, "let*") ||
+        IsNamed(head, "letrec")) {
+        return;
+    }
+    auto rest = As<Cell>(obj)->GetSecond();
+    // Bodies of binding forms have frames of their own, only the initial
+    // values of let and do are evaluated in the enclosing one.
+    if (IsNamed(head, "let") || IsNamed(head, "do")) {
+        if (Is<Cell>(rest) && Is<Symbol>(As<Cell>(rest)->GetFirst())) {
+            rest = As<Cell>(rest)->GetSecond();
+        }
+        auto bindings = Is<Cell>(rest) ? As<Cell>(rest)->GetFirst() : nullptr;
+        for (; Is<Cell>(bindings); bindings = As<Cell>(bindings)->GetSecond()) {
+            auto binding = As<Cell>(bindings)->GetFirst();
+            if (Is<Cell>(binding) && Is<Cell>(As<Cell>(binding)->GetSecond())) {
+                CollectDefines(As<Cell>(As<Cell>(binding)->GetSecond())->GetFirst(), names);
+            }
+        }
+        return;
+    }
+    if (IsNamed(head, "define") && Is<Cell>(rest)) {
+        auto target = As<Cell>(rest)->GetFirst();
+        if (Is<Cell>(target)) {
+            target = As<Cell>(target)->GetFirst();
+            rest = nullptr;
+        }
+        if (Is<Symbol>(target)) {
+            names->insert(As<Symbol>(target)->GetName());
+        }
+    }
+    for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        CollectDefines(As<Cell>(rest)->GetFirst(), names);
+    }
 }
 
-Object* FunctionArgs::Back() const {
-    return *(end_ - 1);
+// Collects targets of set! anywhere, nested lambdas included.
+void CollectAssigned(Object* obj, Names* names) {
+    if (!Is<Cell>(obj) || IsNamed(As<Cell>(obj)->GetFirst(), "quote")) {
+        return;
+    }
+    auto cell = As<Cell>(obj);
+    if (IsNamed(cell->GetFirst(), "set!") && Is<Cell>(cell->GetSecond())) {
+        if (auto target = As<Cell>(cell->GetSecond())->GetFirst(); Is<Symbol>(target)) {
+            names->insert(As<Symbol>(target)->GetName());
+        }
+    }
+    for (; Is<Cell>(obj); obj = As<Cell>(obj)->GetSecond()) {
+        CollectAssigned(As<Cell>(obj)->GetFirst(), names);
+    }
 }
 
-size_t FunctionArgs::Size() const {
-    return end_ - begin_;
+std::shared_ptr<const LambdaInfo> AnalyzeLambda(Object* source, size_t position,
+                                                std::vector<Object*> params,
+                                                std::vector<Object*> body) {
+    Names param_names;
+    for (auto param : params) {
+        ThrowSyntaxErrorIf(!Is<Symbol>(param), "Invalid lambda syntax");
+        param_names.insert(As<Symbol>(param)->GetName());
+    }
+
+    Names symbols, defines, assigned;
+    for (auto body_expr : body) {
+        CollectSymbols(body_expr, &symbols);
+        CollectDefines(body_expr, &defines);
+        CollectAssigned(body_expr, &assigned);
+    }
+
+    auto info = std::make_shared<LambdaInfo>();
+    info->source = source;
+    info->position = position;
+    for (const auto& name : symbols) {
+        if (!param_names.contains(name) && !defines.contains(name)) {
+            info->free_variables.push_back(name);
+        }
+    }
+    for (auto param : params) {
+        const auto& name = As<Symbol>(param)->GetName();
+        info->boxed_params.push_back(assigned.contains(name) || defines.contains(name));
+    }
+    for (const auto& name : defines) {
+        if (!param_names.contains(name)) {
+            info->boxed_defines.push_back(name);
+        }
+    }
+    info->params = std::move(params);
+    info->body = std::move(body);
+    return info;
 }
 
-void FunctionArgs::SkipLast() {
-    if (end_ != begin_) {
-        --end_;
+// The analysis is cached on the head symbol of the form, unless the symbol
+// has been reused for another form.
+std::shared_ptr<const LambdaInfo> GetLambdaInfo(Object* head, Object* source,
+                                                std::vector<Object*> params,
+                                                std::vector<Object*> body) {
+    auto symbol = Is<Symbol>(head) ? As<Symbol>(head) : nullptr;
+    if (symbol) {
+        const auto& info = symbol->GetLambdaInfo();
+        if (info && info->source == source && info->body == body) {
+            return info;
+        }
+    }
+    auto position = symbol ? symbol->GetPosition() : 0;
+    auto info = AnalyzeLambda(source, position, std::move(params), std::move(body));
+    if (symbol) {
+        symbol->SetLambdaInfo(info);
     }
+    return info;
 }
 
-FunctionArgs::Iterator FunctionArgs::begin() const {
-    return begin_;
+struct Binding {
+    Symbol* name;
+    Object* init;
+    // Only do bindings may have a step.
+    std::optional<Object*> step;
+};
+
+std::vector<Binding> ParseBindings(Object* list, bool with_step, const std::string& form) {
+    std::vector<Binding> bindings;
+    for (; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+        auto binding = ObjectToVector(As<Cell>(list)->GetFirst());
+        auto size = binding.size();
+        ThrowSyntaxErrorIf(binding.back() != nullptr || size < 3 || size > (with_step ? 4 : 3) ||
+                               !Is<Symbol>(binding[0]),
+                           form + ": invalid binding");
+        bindings.push_back({As<Symbol>(binding[0]), binding[1], std::nullopt});
+        if (size == 4) {
+            bindings.back().step = binding[2];
+        }
+    }
+    ThrowSyntaxErrorIf(list != nullptr, form + ": invalid bindings");
+    return bindings;
 }
 
-FunctionArgs::Iterator FunctionArgs::end() const {
-    return end_;
+// The frame of a binding form is analyzed like the frame of a lambda with
+// the bound names as parameters and the expressions evaluated in the frame
+// as body.
+std::shared_ptr<const LambdaInfo> GetFrameInfo(Object* head, Object* source,
+                                               const std::vector<Binding>& bindings,
+                                               std::vector<Object*> body) {
+    std::vector<Object*> names;
+    for (const auto& binding : bindings) {
+        names.push_back(binding.name);
+    }
+    return GetLambdaInfo(head, source, std::move(names), std::move(body));
 }
 
-ObjectHolder::ObjectHolder(Object* object, Scope* scope) : object_(object), scope_(scope) {
-    AddDependency(object_);
-    AddDependency(scope_);
+void BindName(Scope* frame, const LambdaInfo& info, size_t ind, Object* value) {
+    const auto& name = As<Symbol>(info.params[ind])->GetName();
+    frame->PutLocal(&name, info.boxed_params[ind] ? Heap::Instance().Make<Box>(value) : value);
 }
 
-Function* ObjectHolder::Execute(FunctionArgs args, Scope*) {
-    ThrowRuntimeErrorIf(args.Size() != 0, "ObjectHolder: no arguments expected");
-    return this;
+// Internal defines get fresh boxes on every entry of the body.
+void ResetDefines(Scope* frame, const LambdaInfo& info) {
+    for (const auto& name : info.boxed_defines) {
+        frame->PutLocal(&name, Heap::Instance().Make<Box>());
+    }
 }
 
-Scope* ObjectHolder::GetScope() const {
-    return scope_;
+template <typename Iterator>
+Object* ProcessBody(Iterator begin, Iterator end, Scope* scope) {
+    Object* res{};
+    for (auto it = begin; it != end; ++it) {
+        res = Process(*it, scope);
+    }
+    return res;
 }
 
-Object* ObjectHolder::GetObject() const {
-    return object_;
+Object* MakeLambda(std::shared_ptr<const LambdaInfo> info, Scope* scope) {
+    Lambda::Captures captures;
+    for (const auto& name : info->free_variables) {
+        if (Object* obj; scope->FindLocal(name, &obj)) {
+            captures.emplace_back(&name, obj);
+        }
+    }
+    return Heap::Instance().Make<Lambda>(std::move(info), std::move(captures),
+                                         scope->GetGlobalScope());
 }
+}  // namespace
 
-const std::string& ObjectHolder::GetName() const {
-    return name_;
+Object* Process(Object* obj, Scope* scope) {
+    if (Is<Symbol>(obj)) {
+        return scope->GetObject(As<Symbol>(obj)->GetName());
+    }
+    if (!Is<Cell>(obj)) {
+        ThrowRuntimeErrorIf(obj == nullptr, "Unexpected expression: ()");
+        return obj;
+    }
+    Fuel::Burn();
+
+    // Procedures evaluate their arguments in place.
+    ArgumentsFrame frame(obj);
+    auto head = *frame.begin();
+    auto func = ExtractFunction(head, scope);
+    if constexpr (kInstrumentationEnabled) {
+        if (!Is<Lambda>(func)) {
+            Instrumentation::Instance().CountCall(typeid(*func));
+        }
+    }
+
+    return func->Execute(FunctionArgs(frame.begin() + 1, frame.end(), head), scope);
 }
 
-void ObjectHolder::SetObject(Object* object) {
-    RemoveDependency(object_);
-    object_ = object;
-    AddDependency(object_);
+bool Function::IsPure() const {
+    return false;
 }
 
-void ObjectHolder::SetName(std::string name) {
-    name_ = std::move(name);
+Procedure::Procedure(Arity arity) : arity_(arity) {
 }
 
-Function* IsBoolean::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "boolean?: expected 1 argument");
+Object* Procedure::Execute(FunctionArgs args, Scope* scope) {
+    CheckArity(args.Size());
     ProcessArgs(args, scope);
+    return Call(args, scope);
+}
+
+Object* Procedure::Invoke(FunctionArgs args, Scope* scope) {
+    CheckArity(args.Size());
+    return Call(args, scope);
+}
+
+void Procedure::CheckArity(size_t size) const {
+    if (size < arity_.min || size > arity_.max) [[unlikely]] {
+        throw RuntimeError(arity_.message);
+    }
+}
 
+IsBoolean::IsBoolean() : Procedure({1, 1, "boolean?: expected 1 argument"}) {
+}
+
+Object* IsBoolean::Call(FunctionArgs args, Scope* scope) {
     if (Is<Symbol>(args[0])) {
         const auto& name = As<Symbol>(args[0])->GetName();
         if (name == "#t" || name == "#f") {
-            return GetTrueFunction(scope);
+            return GetTrue(scope);
         }
     }
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
 }
 
-Function* Not::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "not: expected 1 argument");
-    ProcessArgs(args, scope);
+bool IsBoolean::IsPure() const {
+    return true;
+}
 
-    if (Is<Symbol>(args[0]) && As<Symbol>(args[0])->GetName() == "#f") {
-        return GetTrueFunction(scope);
+Not::Not() : Procedure({1, 1, "not: expected 1 argument"}) {
+}
+
+Object* Not::Call(FunctionArgs args, Scope* scope) {
+    if (IsFalse(args[0])) {
+        return GetTrue(scope);
     }
 
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
 }
 
-Function* And::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
+bool Not::IsPure() const {
+    return true;
+}
 
+Object* And::Execute(FunctionArgs args, Scope* scope) {
     for (auto& arg : args) {
         arg = Process(arg, scope);
-        if (Is<Symbol>(arg) && As<Symbol>(arg)->GetName() == "#f") {
-            return GetFalseFunction(scope);
+        if (IsFalse(arg)) {
+            return arg;
         }
     }
 
     if (args.Size() == 0) {
-        return GetTrueFunction(scope);
+        return GetTrue(scope);
     }
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(args.Back(), scope));
+    return args.Back();
 }
 
-Function* Or::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
+bool And::IsPure() const {
+    return true;
+}
 
+Object* Or::Execute(FunctionArgs args, Scope* scope) {
     for (auto& arg : args) {
         arg = Process(arg, scope);
-        if (!(Is<Symbol>(arg) && As<Symbol>(arg)->GetName() == "#f")) {
-            return As<Function>(Heap::Instance().Make<ObjectHolder>(arg, scope));
+        if (!IsFalse(arg)) {
+            return arg;
         }
     }
 
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
 }
 
-Function* IsNumber::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "number?: expected 1 argument");
-    ProcessArgs(args, scope);
+bool Or::IsPure() const {
+    return true;
+}
+
+IsNumber::IsNumber() : Procedure({1, 1, "number?: expected 1 argument"}) {
+}
 
+Object* IsNumber::Call(FunctionArgs args, Scope* scope) {
     if (Is<Number>(args[0])) {
-        return GetTrueFunction(scope);
+        return GetTrue(scope);
     }
 
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
 }
 
-Function* Equal::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
-    ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
-
-    for (size_t i = 0, size = args.Size(); i + 1 < size; ++i) {
-        auto cur = As<Number>(args[i]);
-        auto next = As<Number>(args[i + 1]);
-        if (cur->GetValue() != next->GetValue()) {
-            return GetFalseFunction(scope);
-        }
-    }
-
-    return GetTrueFunction(scope);
+bool IsNumber::IsPure() const {
+    return true;
 }
 
-Function* MonotonicallyIncreasing::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
+template <bool (*Holds)(std::partial_ordering)>
+Object* NumberComparison<Holds>::Call(FunctionArgs args, Scope* scope) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
     for (size_t i = 0, size = args.Size(); i + 1 < size; ++i) {
-        auto cur = As<Number>(args[i]);
-        auto next = As<Number>(args[i + 1]);
-        if (cur->GetValue() >= next->GetValue()) {
-            return GetFalseFunction(scope);
+        const auto& cur = As<Number>(args[i])->GetValue();
+        const auto& next = As<Number>(args[i + 1])->GetValue();
+        auto cur_fixnum = std::get_if<int64_t>(&cur);
+        auto next_fixnum = std::get_if<int64_t>(&next);
+        auto order = cur_fixnum && next_fixnum ? *cur_fixnum <=> *next_fixnum
+                                               : CompareNumbers(cur, next);
+        if (!Holds(order)) {
+            return GetFalse(scope);
         }
     }
 
-    return GetTrueFunction(scope);
+    return GetTrue(scope);
 }
 
-Function* MonotonicallyDecreasing::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
+template <bool (*Holds)(std::partial_ordering)>
+bool NumberComparison<Holds>::IsPure() const {
+    return true;
+}
+
+template class NumberComparison<std::is_eq>;
+template class NumberComparison<std::is_lt>;
+template class NumberComparison<std::is_gt>;
+template class NumberComparison<std::is_gteq>;
+template class NumberComparison<std::is_lteq>;
+
+Object* Plus::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    for (size_t i = 0, size = args.Size(); i + 1 < size; ++i) {
-        auto cur = As<Number>(args[i]);
-        auto next = As<Number>(args[i + 1]);
-        if (cur->GetValue() <= next->GetValue()) {
-            return GetFalseFunction(scope);
-        }
+    NumberValue sum = int64_t{0};
+    for (const auto& arg : args) {
+        sum = AddNumbers(sum, As<Number>(arg)->GetValue());
     }
 
-    return GetTrueFunction(scope);
+    return Heap::Instance().Make<Number>(sum);
 }
 
-Function* MonotonicallyNonIncreasing::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
-    ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
-
-    for (size_t i = 0, size = args.Size(); i + 1 < size; ++i) {
-        auto cur = As<Number>(args[i]);
-        auto next = As<Number>(args[i + 1]);
-        if (cur->GetValue() < next->GetValue()) {
-            return GetFalseFunction(scope);
-        }
-    }
+bool Plus::IsPure() const {
+    return true;
+}
 
-    return GetTrueFunction(scope);
+Minus::Minus() : Procedure({1, SIZE_MAX, "-: expected >= 1 argument"}) {
 }
 
-Function* MonotonicallyNonDecreasing::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
+Object* Minus::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    for (size_t i = 0, size = args.Size(); i + 1 < size; ++i) {
-        auto cur = As<Number>(args[i]);
-        auto next = As<Number>(args[i + 1]);
-        if (cur->GetValue() > next->GetValue()) {
-            return GetFalseFunction(scope);
-        }
+    auto result = As<Number>(args[0])->GetValue();
+    for (size_t i = 1, size = args.Size(); i < size; ++i) {
+        result = SubtractNumbers(result, As<Number>(args[i])->GetValue());
     }
 
-    return GetTrueFunction(scope);
+    return Heap::Instance().Make<Number>(result);
 }
 
-Function* Plus::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
+bool Minus::IsPure() const {
+    return true;
+}
+
+Object* Multiply::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    int32_t sum = 0;
+    NumberValue prod = int64_t{1};
     for (const auto& arg : args) {
-        sum += As<Number>(arg)->GetValue();
+        prod = MultiplyNumbers(prod, As<Number>(arg)->GetValue());
     }
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(sum)));
+    return Heap::Instance().Make<Number>(prod);
 }
 
-Function* Minus::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() == 0, "-: expected >= 1 argument");
-    ProcessArgs(args, scope);
+bool Multiply::IsPure() const {
+    return true;
+}
+
+Divide::Divide() : Procedure({1, SIZE_MAX, "/: expected >= 1 argument"}) {
+}
+
+Object* Divide::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    int32_t result = As<Number>(args[0])->GetValue();
+    auto result = As<Number>(args[0])->GetValue();
     for (size_t i = 1, size = args.Size(); i < size; ++i) {
-        result -= As<Number>(args[i])->GetValue();
+        result = DivideNumbers(result, As<Number>(args[i])->GetValue());
     }
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(result)));
+    return Heap::Instance().Make<Number>(result);
 }
 
-Function* Multiply::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ProcessArgs(args, scope);
+bool Divide::IsPure() const {
+    return true;
+}
+
+Max::Max() : Procedure({1, SIZE_MAX, "max: expected >= 1 argument"}) {
+}
+
+Object* Max::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    int32_t prod = 1;
+    auto max = As<Number>(args[0]);
     for (const auto& arg : args) {
-        prod *= As<Number>(arg)->GetValue();
+        if (CompareNumbers(As<Number>(arg)->GetValue(), max->GetValue()) > 0) {
+            max = As<Number>(arg);
+        }
     }
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(prod)));
+    return ToInexactIfAny(max, args);
 }
 
-Function* Divide::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() == 0, "/: expected >= 1 argument");
-    ProcessArgs(args, scope);
-    ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
-
-    int32_t result = As<Number>(args[0])->GetValue();
-    for (size_t i = 1, size = args.Size(); i < size; ++i) {
-        result /= As<Number>(args[i])->GetValue();
-    }
+bool Max::IsPure() const {
+    return true;
+}
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(result)));
+Min::Min() : Procedure({1, SIZE_MAX, "min: expected >= 1 argument"}) {
 }
 
-Function* Max::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() == 0, "max: expected >= 1 argument");
-    ProcessArgs(args, scope);
+Object* Min::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    int32_t max = As<Number>(args[0])->GetValue();
+    auto min = As<Number>(args[0]);
     for (const auto& arg : args) {
-        max = std::max(max, As<Number>(arg)->GetValue());
+        if (CompareNumbers(As<Number>(arg)->GetValue(), min->GetValue()) < 0) {
+            min = As<Number>(arg);
+        }
     }
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(max)));
+    return ToInexactIfAny(min, args);
 }
 
-Function* Min::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() == 0, "min: expected >= 1 argument");
-    ProcessArgs(args, scope);
-    ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
-
-    int32_t min = As<Number>(args[0])->GetValue();
-    for (const auto& arg : args) {
-        min = std::min(min, As<Number>(arg)->GetValue());
-    }
+bool Min::IsPure() const {
+    return true;
+}
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(min)));
+Abs::Abs() : Procedure({1, 1, "abs: expected 1 argument"}) {
 }
 
-Function* Abs::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "abs: expected 1 argument");
-    ProcessArgs(args, scope);
+Object* Abs::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!args.AreExpectedType<Number>());
 
-    auto value = As<Number>(args[0])->GetValue();
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Number>(std::abs(value))));
+    return Heap::Instance().Make<Number>(AbsNumber(As<Number>(args[0])->GetValue()));
+}
+
+bool Abs::IsPure() const {
+    return true;
 }
 
-Function* Quote::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
+Object* Quote::Execute(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(args.Size() != 1, "quote: expected 1 argument");
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(args[0], scope));
+    return args[0];
 }
 
-Function* IsPair::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "pair?: expected 1 argument");
-    ProcessArgs(args, scope);
+IsPair::IsPair() : Procedure({1, 1, "pair?: expected 1 argument"}) {
+}
 
-    auto vector = ObjectToVector(args[0]);
-    if (auto size = vector.size(); size == 2 || (size == 3 && vector.back() == nullptr)) {
-        return GetTrueFunction(scope);
+Object* IsPair::Call(FunctionArgs args, Scope* scope) {
+    if (Is<Cell>(args[0])) {
+        return GetTrue(scope);
     }
 
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
 }
 
-Function* IsNull::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "null?: expected 1 argument");
-    ProcessArgs(args, scope);
+IsNull::IsNull() : Procedure({1, 1, "null?: expected 1 argument"}) {
+}
 
-    auto vector = ObjectToVector(args[0]);
-    if (vector.size() == 1 && vector.back() == nullptr) {
-        return GetTrueFunction(scope);
+Object* IsNull::Call(FunctionArgs args, Scope* scope) {
+    if (args[0] == nullptr) {
+        return GetTrue(scope);
     }
 
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
 }
 
-Function* IsList::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "list?: expected 1 argument");
-    ProcessArgs(args, scope);
+IsList::IsList() : Procedure({1, 1, "list?: expected 1 argument"}) {
+}
 
-    auto vector = ObjectToVector(args[0]);
-    if (vector.back() == nullptr) {
-        return GetTrueFunction(scope);
+Object* IsList::Call(FunctionArgs args, Scope* scope) {
+    if (IsProperList(args[0])) {
+        return GetTrue(scope);
     }
 
-    return GetFalseFunction(scope);
+    return GetFalse(scope);
+}
+
+Cons::Cons() : Procedure({2, 2, "cons: expected 2 arguments"}) {
 }
 
-Function* Cons::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 2, "cons: expected 2 arguments");
+Object* Cons::Call(FunctionArgs args, Scope*) {
+    return Heap::Instance().Make<Cell>(args[0], args[1]);
+}
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Cell>(args[0], args[1]),
-                                               scope));
+Car::Car() : Procedure({1, 1, "car: expected 1 argument"}) {
 }
 
-Function* Car::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "car: expected 1 argument");
+Object* Car::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Cell>(args[0]), "car: expected list with >= 1 argument");
 
-    auto func = ExtractFunctionAndExecute(args[0], scope);
-    auto obj = As<ObjectHolder>(func)->GetObject();
-    auto obj_scope = As<ObjectHolder>(func)->GetScope();
-    auto vector = ObjectToVector(obj);
-    ThrowRuntimeErrorIf(vector.size() < 2, "car: expected list with >= 1 argument");
+    return As<Cell>(args[0])->GetFirst();
+}
 
-    return ExtractFunction(vector[0], obj_scope);
+Cdr::Cdr() : Procedure({1, 1, "cdr: expected 1 argument"}) {
 }
 
-Function* Cdr::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "cdr: expected 1 argument");
+Object* Cdr::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Cell>(args[0]), "cdr: expected list with >= 1 argument");
 
-    auto func = ExtractFunctionAndExecute(args[0], scope);
-    auto obj = As<ObjectHolder>(func)->GetObject();
-    auto obj_scope = As<ObjectHolder>(func)->GetScope();
-    auto vector = ObjectToVector(obj);
-    ThrowRuntimeErrorIf(vector.size() < 2, "cdr: expected list with >= 1 argument");
-    vector.erase(vector.begin());
+    return As<Cell>(args[0])->GetSecond();
+}
 
-    if (vector[0] == nullptr || Is<Number>(vector[0])) {
-        return As<Function>(Heap::Instance().Make<ObjectHolder>(VectorToObject(vector), obj_scope));
+Object* List::Call(FunctionArgs args, Scope*) {
+    Object* result = nullptr;
+    for (auto i = args.Size(); i-- > 0;) {
+        result = Heap::Instance().Make<Cell>(args[i], result);
     }
 
-    return ExtractFunction(VectorToObject(vector), obj_scope);
+    return result;
 }
 
-Function* List::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-
-    auto vector = std::vector(args.begin(), args.end());
-    vector.push_back(nullptr);
-
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(VectorToObject(vector), scope));
+ListRef::ListRef() : Procedure({2, 2, "list-ref: expected 2 arguments"}) {
 }
 
-Function* ListRef::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 2, "list-ref: expected 2 arguments");
-    ProcessArgs(args, scope);
+Object* ListRef::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!Is<Number>(args[1]), "list-ref: expected <List> <Ind>");
 
-    auto vector = ObjectToVector(args[0]);
-    size_t ind = As<Number>(args[1])->GetValue();
-    ThrowRuntimeErrorIf(ind >= vector.size() - 1, "list-ref: index out of range");
+    auto tail = SkipCells(args[0], ToIndex(As<Number>(args[1])));
+    ThrowRuntimeErrorIf(!Is<Cell>(tail), "list-ref: index out of range");
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(vector[ind], scope));
+    return As<Cell>(tail)->GetFirst();
 }
 
-Function* ListTail::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 2, "list-tail: expected 2 arguments");
-    ProcessArgs(args, scope);
+ListTail::ListTail() : Procedure({2, 2, "list-tail: expected 2 arguments"}) {
+}
+
+Object* ListTail::Call(FunctionArgs args, Scope*) {
     ThrowRuntimeErrorIf(!Is<Number>(args[1]), "list-tail: expected <List> <Ind>");
 
-    auto vector = ObjectToVector(args[0]);
-    size_t ind = As<Number>(args[1])->GetValue();
-    ThrowRuntimeErrorIf(ind > vector.size() - 1, "list-tail: index out of range");
+    auto ind = ToIndex(As<Number>(args[1]));
+    auto tail = SkipCells(args[0], ind);
+    ThrowRuntimeErrorIf(ind != 0 && !Is<Cell>(SkipCells(args[0], ind - 1)),
+                        "list-tail: index out of range");
 
-    auto result_vector = std::vector(vector.begin() + ind, vector.end());
+    return tail;
+}
 
-    return As<Function>(Heap::Instance().Make<ObjectHolder>(VectorToObject(result_vector), scope));
+Length::Length() : Procedure({1, 1, "length: expected 1 argument"}) {
 }
 
-Function* IsSymbol::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != 1, "symbol?: expected 1 argument");
-    ProcessArgs(args, scope);
+Object* Length::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!IsProperList(args[0]), "length: expected <List>");
 
-    if (Is<Symbol>(args[0])) {
-        return GetTrueFunction(scope);
+    int64_t length = 0;
+    for (auto obj = args[0]; obj; obj = As<Cell>(obj)->GetSecond()) {
+        ++length;
     }
 
-    return GetFalseFunction(scope);
+    return Heap::Instance().Make<Number>(length);
 }
 
-Function* Define::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-
-    if (bool used_syntax_sugar = Is<Cell>(args[0]); used_syntax_sugar) {
-        ThrowSyntaxErrorIf(args.Size() < 2, "define: lambda sugar");
-        auto vector = ObjectToVector(args[0]);
-        const auto& name = As<Symbol>(vector[0])->GetName();
-        auto func = As<Function>(Heap::Instance().Make<Lambda>(std::vector(vector.begin() + 1, vector.end() - 1),
-                                                  std::vector(args.begin() + 1, args.end()), scope));
-        scope->PutFunction(name, func);
+Object* Append::Call(FunctionArgs args, Scope*) {
+    if (args.Size() == 0) {
+        return nullptr;
+    }
 
-    } else {
-        ThrowSyntaxErrorIf(args.Size() != 2, "define: expected 2 arguments");
-        const auto& name = As<Symbol>(args[0])->GetName();
-        scope->PutFunction(name, ExtractFunction(args[1], scope));
+    // All lists but the last one are copied, the last one is shared.
+    ListBuilder result;
+    for (size_t i = 0; i + 1 < args.Size(); ++i) {
+        ThrowRuntimeErrorIf(!IsProperList(args[i]), "append: expected <List> ... <Obj>");
+        for (auto obj = args[i]; obj; obj = As<Cell>(obj)->GetSecond()) {
+            result.Append(As<Cell>(obj)->GetFirst());
+        }
     }
 
-    return nullptr;
+    return result.Finish(args.Back());
 }
 
-Function* Set::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowSyntaxErrorIf(args.Size() != 2, "set!: expected 2 arguments");
-    ThrowRuntimeErrorIf(!Is<Symbol>(args[0]), "set!: expected <Name> <Expr>");
+Reverse::Reverse() : Procedure({1, 1, "reverse: expected 1 argument"}) {
+}
 
-    const auto& name = As<Symbol>(args[0])->GetName();
-    scope->SetFunction(name, ExtractFunctionAndExecute(args[1], scope));
+Object* Reverse::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!IsProperList(args[0]), "reverse: expected <List>");
 
-    return nullptr;
+    Object* result = nullptr;
+    for (auto obj = args[0]; obj; obj = As<Cell>(obj)->GetSecond()) {
+        result = Heap::Instance().Make<Cell>(As<Cell>(obj)->GetFirst(), result);
+    }
+
+    return result;
 }
 
-Function* SetCar::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowSyntaxErrorIf(args.Size() != 2, "set-car!: expected 2 arguments");
+Map::Map() : Procedure({2, SIZE_MAX, "map: expected <Proc> <List> ..."}) {
+}
 
-    auto first = ExtractFunctionAndExecute(args[0], scope);
-    auto pair = As<ObjectHolder>(first)->GetObject();
-    auto vector = ObjectToVector(pair);
-    ThrowRuntimeErrorIf(vector.size() != 2);
+Object* Map::Call(FunctionArgs args, Scope* scope) {
+    auto proc = ToProcedure(args[0], "map: expected <Proc> <List> ...");
 
-    auto second = ExtractFunctionAndExecute(args[1], scope);
-    auto second_arg = As<ObjectHolder>(second)->GetObject();
-    if (Is<Number>(second_arg)) {
-        vector[0] = second_arg;
-    } else {
-        vector[0] = Heap::Instance().Make<Symbol>(As<ObjectHolder>(second)->GetName());
+    ListBuilder result;
+    ListWalker walker(args.begin() + 1, args.end());
+    while (walker.Next()) {
+        result.Append(proc->Invoke(walker.GetArgs(), scope));
     }
+    walker.Check("map: expected lists");
+
+    return result.Finish();
+}
+
+ForEach::ForEach() : Procedure({2, SIZE_MAX, "for-each: expected <Proc> <List> ..."}) {
+}
 
-    auto new_object = VectorToObject(vector);
-    As<ObjectHolder>(first)->SetObject(new_object);
+Object* ForEach::Call(FunctionArgs args, Scope* scope) {
+    auto proc = ToProcedure(args[0], "for-each: expected <Proc> <List> ...");
+
+    ListWalker walker(args.begin() + 1, args.end());
+    while (walker.Next()) {
+        proc->Invoke(walker.GetArgs(), scope);
+    }
+    walker.Check("for-each: expected lists");
 
     return nullptr;
 }
 
-Function* SetCdr::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowSyntaxErrorIf(args.Size() != 2, "set-cdr!: expected 2 arguments");
+Filter::Filter() : Procedure({2, 2, "filter: expected <Pred> <List>"}) {
+}
 
-    auto first = ExtractFunctionAndExecute(args[0], scope);
-    auto pair = As<ObjectHolder>(first)->GetObject();
-    auto vector = ObjectToVector(pair);
-    ThrowRuntimeErrorIf(vector.size() != 2);
+Object* Filter::Call(FunctionArgs args, Scope* scope) {
+    auto pred = ToProcedure(args[0], "filter: expected <Pred> <List>");
 
-    auto second = ExtractFunctionAndExecute(args[1], scope);
-    auto second_arg = As<ObjectHolder>(second)->GetObject();
-    if (Is<Number>(second_arg)) {
-        vector[1] = second_arg;
-    } else {
-        vector[1] = Heap::Instance().Make<Symbol>(As<ObjectHolder>(second)->GetName());
+    ListBuilder result;
+    ListWalker walker(args.begin() + 1, args.end());
+    while (walker.Next()) {
+        auto element = walker.GetArgs()[0];
+        if (!IsFalse(pred->Invoke(walker.GetArgs(), scope))) {
+            result.Append(element);
+        }
     }
+    walker.Check("filter: expected <Pred> <List>");
 
-    auto new_object = VectorToObject(vector);
-    As<ObjectHolder>(first)->SetObject(new_object);
+    return result.Finish();
+}
 
-    return nullptr;
+FoldLeft::FoldLeft() : Procedure({3, SIZE_MAX, "fold-left: expected <Proc> <Init> <List> ..."}) {
 }
 
-Function* If::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowSyntaxErrorIf(args.Size() != 2 && args.Size() != 3,
-                       "if: expected <cond> <true_br> [<false_br>]");
+Object* FoldLeft::Call(FunctionArgs args, Scope* scope) {
+    auto proc = ToProcedure(args[0], "fold-left: expected <Proc> <Init> <List> ...");
 
-    auto cond = Process(args[0], scope);
-    if (!(Is<Symbol>(cond) && As<Symbol>(cond)->GetName() == "#f")) {
-        return ExtractFunctionAndExecute(args[1], scope);
+    // The accumulator goes first: (proc acc x1 x2 ...).
+    auto acc = args[1];
+    ListWalker walker(args.begin() + 2, args.end(), 1);
+    while (walker.Next()) {
+        walker.GetArgs().begin()[0] = acc;
+        acc = proc->Invoke(walker.GetArgs(), scope);
     }
+    walker.Check("fold-left: expected lists");
 
-    if (args.Size() == 3) {
-        return ExtractFunctionAndExecute(args[2], scope);
-    }
+    return acc;
+}
 
-    return nullptr;
+FoldRight::FoldRight() : Procedure({3, SIZE_MAX, "fold-right: expected <Proc> <Init> <List> ..."}) {
 }
 
-Function* CreateLambda::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowSyntaxErrorIf(args.Size() < 2, "Invalid lambda syntax");
+Object* FoldRight::Call(FunctionArgs args, Scope* scope) {
+    auto proc = ToProcedure(args[0], "fold-right: expected <Proc> <Init> <List> ...");
 
-    auto lambda_params = ObjectToVector(args[0]);
-    lambda_params.pop_back();
-    auto lambda_body = std::vector(args.begin() + 1, args.end());
+    // Rows of elements are collected to be folded from the right, the lists
+    // themselves are not copied.
+    auto lists_count = args.Size() - 2;
+    std::vector<Object*> rows;
+    ListWalker walker(args.begin() + 2, args.end());
+    while (walker.Next()) {
+        rows.insert(rows.end(), walker.GetArgs().begin(), walker.GetArgs().end());
+    }
+    walker.Check("fold-right: expected lists");
+
+    // The accumulator goes last: (proc x1 x2 ... acc).
+    auto acc = args[1];
+    std::vector<Object*> call_args(lists_count + 1);
+    for (auto row_end = rows.end(); row_end != rows.begin(); row_end -= lists_count) {
+        std::copy(row_end - lists_count, row_end, call_args.begin());
+        call_args.back() = acc;
+        acc = proc->Invoke(FunctionArgs(call_args), scope);
+    }
 
-    return As<Function>(Heap::Instance().Make<Lambda>(
-        std::move(lambda_params), std::move(lambda_body), scope));
+    return acc;
 }
 
-Lambda::Lambda(std::vector<Object*> args, std::vector<Object*> body, Scope* parent_scope)
-    : args_(std::move(args)), body_(std::move(body)), parent_scope_(parent_scope) {
-    for (auto arg : args_) {
-        AddDependency(arg);
-    }
-    for (auto body_expr : body_) {
-        AddDependency(body_expr);
+Assoc::Assoc() : Procedure({2, 2, "assoc: expected <Key> <Alist>"}) {
+}
+
+Object* Assoc::Call(FunctionArgs args, Scope* scope) {
+    for (auto obj = args[1]; Is<Cell>(obj); obj = As<Cell>(obj)->GetSecond()) {
+        auto entry = As<Cell>(obj)->GetFirst();
+        ThrowRuntimeErrorIf(!Is<Cell>(entry), "assoc: expected <Key> <Alist>");
+        if (AreEqual(args[0], As<Cell>(entry)->GetFirst())) {
+            return entry;
+        }
     }
-    AddDependency(parent_scope_);
+
+    return GetFalse(scope);
 }
 
-Function* Lambda::Execute(FunctionArgs args, Scope* scope) {
-    args.SkipLast();
-    ThrowRuntimeErrorIf(args.Size() != args_.size(), "lambda: invalid number of arguments");
+Member::Member() : Procedure({2, 2, "member: expected <Obj> <List>"}) {
+}
 
-    auto cur_scope = As<Scope>(Heap::Instance().Make<Scope>(parent_scope_));
+Object* Member::Call(FunctionArgs args, Scope* scope) {
+    for (auto obj = args[1]; Is<Cell>(obj); obj = As<Cell>(obj)->GetSecond()) {
+        if (AreEqual(args[0], As<Cell>(obj)->GetFirst())) {
+            return obj;
+        }
+    }
 
-    for (size_t i = 0, size = args.Size(); i < size; ++i) {
-        const auto& name = As<Symbol>(args_[i])->GetName();
-        cur_scope->PutFunction(name, ExtractFunctionAndExecute(args[i], scope));
+    return GetFalse(scope);
+}
+
+Apply::Apply() : Procedure({2, SIZE_MAX, "apply: expected <Proc> <Obj> ... <List>"}) {
+}
+
+Object* Apply::Call(FunctionArgs args, Scope* scope) {
+    auto proc = ToProcedure(args[0], "apply: expected <Proc> <Obj> ... <List>");
+    ThrowRuntimeErrorIf(!IsProperList(args.Back()), "apply: expected <Proc> <Obj> ... <List>");
+
+    std::vector<Object*> call_args(args.begin() + 1, args.end() - 1);
+    for (auto obj = args.Back(); obj; obj = As<Cell>(obj)->GetSecond()) {
+        call_args.push_back(As<Cell>(obj)->GetFirst());
+    }
+
+    return proc->Invoke(FunctionArgs(call_args), scope);
+}
+
+IsVector::IsVector() : Procedure({1, 1, "vector?: expected 1 argument"}) {
+}
+
+Object* IsVector::Call(FunctionArgs args, Scope* scope) {
+    if (Is<Vector>(args[0])) {
+        return GetTrue(scope);
+    }
+
+    return GetFalse(scope);
+}
+
+MakeVector::MakeVector() : Procedure({1, 2, "make-vector: expected <Size> [<Fill>]"}) {
+}
+
+Object* MakeVector::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Number>(args[0]), "make-vector: expected <Size> [<Fill>]");
+
+    auto size = ToIndex(As<Number>(args[0]));
+    ThrowRuntimeErrorIf(size == SIZE_MAX, "make-vector: invalid size");
+    auto fill = args.Size() == 2 ? args[1] : Heap::Instance().Make<Number>(int64_t{0});
+
+    return Heap::Instance().Make<Vector>(std::vector<Object*>(size, fill));
+}
+
+Object* CreateVector::Call(FunctionArgs args, Scope*) {
+    return Heap::Instance().Make<Vector>(std::vector(args.begin(), args.end()));
+}
+
+VectorLength::VectorLength() : Procedure({1, 1, "vector-length: expected 1 argument"}) {
+}
+
+Object* VectorLength::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Vector>(args[0]), "vector-length: expected <Vector>");
+
+    return Heap::Instance().Make<Number>(static_cast<int64_t>(As<Vector>(args[0])->Size()));
+}
+
+VectorRef::VectorRef() : Procedure({2, 2, "vector-ref: expected 2 arguments"}) {
+}
+
+Object* VectorRef::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Vector>(args[0]) || !Is<Number>(args[1]),
+                        "vector-ref: expected <Vector> <Ind>");
+
+    auto vector = As<Vector>(args[0]);
+    auto ind = ToIndex(As<Number>(args[1]));
+    ThrowRuntimeErrorIf(ind >= vector->Size(), "vector-ref: index out of range");
+
+    return vector->Get(ind);
+}
+
+VectorSet::VectorSet() : Procedure({3, 3, "vector-set!: expected 3 arguments"}) {
+}
+
+Object* VectorSet::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Vector>(args[0]) || !Is<Number>(args[1]),
+                        "vector-set!: expected <Vector> <Ind> <Obj>");
+
+    auto vector = As<Vector>(args[0]);
+    auto ind = ToIndex(As<Number>(args[1]));
+    ThrowRuntimeErrorIf(ind >= vector->Size(), "vector-set!: index out of range");
+    vector->Set(ind, args[2]);
+
+    return nullptr;
+}
+
+VectorFill::VectorFill() : Procedure({2, 2, "vector-fill!: expected 2 arguments"}) {
+}
+
+Object* VectorFill::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Vector>(args[0]), "vector-fill!: expected <Vector> <Obj>");
+
+    As<Vector>(args[0])->Fill(args[1]);
+
+    return nullptr;
+}
+
+IsBytevector::IsBytevector() : Procedure({1, 1, "bytevector?: expected 1 argument"}) {
+}
+
+Object* IsBytevector::Call(FunctionArgs args, Scope* scope) {
+    if (Is<Bytevector>(args[0])) {
+        return GetTrue(scope);
+    }
+
+    return GetFalse(scope);
+}
+
+MakeBytevector::MakeBytevector() : Procedure({1, 2, "make-bytevector: expected 1 or 2 arguments"}) {
+}
+
+Object* MakeBytevector::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Number>(args[0]), "make-bytevector: expected <Size> [<Byte>]");
+
+    auto size = ToIndex(As<Number>(args[0]));
+    ThrowRuntimeErrorIf(size == SIZE_MAX, "make-bytevector: invalid size");
+    uint8_t fill = 0;
+    if (args.Size() == 2) {
+        fill = ToByte(args[1], "make-bytevector: expected <Size> [<Byte>]");
+    }
+
+    std::vector<uint8_t> bytes(size);
+    FillBytes(bytes.data(), size, fill);
+    return Heap::Instance().Make<Bytevector>(std::move(bytes));
+}
+
+Object* CreateBytevector::Call(FunctionArgs args, Scope*) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(args.Size());
+    for (auto arg : args) {
+        bytes.push_back(ToByte(arg, "bytevector: expected bytes"));
+    }
+
+    return Heap::Instance().Make<Bytevector>(std::move(bytes));
+}
+
+BytevectorLength::BytevectorLength() : Procedure({1, 1, "bytevector-length: expected 1 argument"}) {
+}
+
+Object* BytevectorLength::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]), "bytevector-length: expected <Bytevector>");
+
+    auto size = As<Bytevector>(args[0])->Size();
+    return Heap::Instance().Make<Number>(static_cast<int64_t>(size));
+}
+
+BytevectorRef::BytevectorRef() : Procedure({2, 2, "bytevector-u8-ref: expected 2 arguments"}) {
+}
+
+Object* BytevectorRef::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]) || !Is<Number>(args[1]),
+                        "bytevector-u8-ref: expected <Bytevector> <Ind>");
+
+    auto bytevector = As<Bytevector>(args[0]);
+    auto ind = ToIndex(As<Number>(args[1]));
+    ThrowRuntimeErrorIf(ind >= bytevector->Size(), "bytevector-u8-ref: index out of range");
+
+    return Heap::Instance().Make<Number>(int64_t{bytevector->Data()[ind]});
+}
+
+BytevectorSet::BytevectorSet() : Procedure({3, 3, "bytevector-u8-set!: expected 3 arguments"}) {
+}
+
+Object* BytevectorSet::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]) || !Is<Number>(args[1]),
+                        "bytevector-u8-set!: expected <Bytevector> <Ind> <Byte>");
+
+    auto bytevector = As<Bytevector>(args[0]);
+    auto ind = ToIndex(As<Number>(args[1]));
+    ThrowRuntimeErrorIf(ind >= bytevector->Size(), "bytevector-u8-set!: index out of range");
+    bytevector->Data()[ind] =
+        ToByte(args[2], "bytevector-u8-set!: expected <Bytevector> <Ind> <Byte>");
+
+    return nullptr;
+}
+
+// (bytevector-copy! to at from [start [end]]), the ranges may overlap.
+BytevectorCopy::BytevectorCopy()
+    : Procedure({3, 5, "bytevector-copy!: expected 3 to 5 arguments"}) {
+}
+
+Object* BytevectorCopy::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]) || !Is<Number>(args[1]) ||
+                            !Is<Bytevector>(args[2]),
+                        "bytevector-copy!: expected <To> <At> <From> [<Start> [<End>]]");
+
+    auto to = As<Bytevector>(args[0]);
+    auto at = ToIndex(As<Number>(args[1]));
+    auto from = As<Bytevector>(args[2]);
+    auto [start, end] = ToRange(args, 3, from->Size(), "bytevector-copy!: invalid range");
+    ThrowRuntimeErrorIf(at > to->Size() || end - start > to->Size() - at,
+                        "bytevector-copy!: index out of range");
+    std::memmove(to->Data() + at, from->Data() + start, end - start);
+
+    return nullptr;
+}
+
+BytevectorFill::BytevectorFill()
+    : Procedure({2, 4, "bytevector-fill!: expected 2 to 4 arguments"}) {
+}
+
+Object* BytevectorFill::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]),
+                        "bytevector-fill!: expected <Bytevector> <Byte> [<Start> [<End>]]");
+
+    auto bytevector = As<Bytevector>(args[0]);
+    auto fill = ToByte(args[1], "bytevector-fill!: expected <Bytevector> <Byte> [<Start> [<End>]]");
+    auto [start, end] = ToRange(args, 2, bytevector->Size(), "bytevector-fill!: invalid range");
+    FillBytes(bytevector->Data() + start, end - start, fill);
+
+    return nullptr;
+}
+
+BytevectorEqual::BytevectorEqual() : Procedure({2, 2, "bytevector=?: expected 2 arguments"}) {
+}
+
+Object* BytevectorEqual::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]) || !Is<Bytevector>(args[1]),
+                        "bytevector=?: expected <Bytevector> <Bytevector>");
+
+    auto lhs = As<Bytevector>(args[0]);
+    auto rhs = As<Bytevector>(args[1]);
+    if (lhs->Size() == rhs->Size() && CompareBytes(lhs->Data(), rhs->Data(), lhs->Size()) == 0) {
+        return GetTrue(scope);
+    }
+
+    return GetFalse(scope);
+}
+
+// Lexicographic order, a proper prefix comes first: -1, 0 or 1.
+BytevectorCompare::BytevectorCompare()
+    : Procedure({2, 2, "bytevector-compare: expected 2 arguments"}) {
+}
+
+Object* BytevectorCompare::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]) || !Is<Bytevector>(args[1]),
+                        "bytevector-compare: expected <Bytevector> <Bytevector>");
+
+    auto lhs = As<Bytevector>(args[0]);
+    auto rhs = As<Bytevector>(args[1]);
+    auto cmp = CompareBytes(lhs->Data(), rhs->Data(), std::min(lhs->Size(), rhs->Size()));
+    if (cmp == 0) {
+        cmp = lhs->Size() < rhs->Size() ? -1 : lhs->Size() > rhs->Size() ? 1 : 0;
+    }
+
+    return Heap::Instance().Make<Number>(int64_t{cmp < 0 ? -1 : cmp > 0 ? 1 : 0});
+}
+
+// (bytevector-search haystack needle [start]) returns the index of the first
+// occurrence at or after start, or #f.
+BytevectorSearch::BytevectorSearch()
+    : Procedure({2, 3, "bytevector-search: expected 2 or 3 arguments"}) {
+}
+
+Object* BytevectorSearch::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(!Is<Bytevector>(args[0]) || !Is<Bytevector>(args[1]) ||
+                            (args.Size() == 3 && !Is<Number>(args[2])),
+                        "bytevector-search: expected <Bytevector> <Bytevector> [<Start>]");
+
+    auto haystack = As<Bytevector>(args[0]);
+    auto needle = As<Bytevector>(args[1]);
+    size_t start = args.Size() == 3 ? ToIndex(As<Number>(args[2])) : 0;
+    ThrowRuntimeErrorIf(start > haystack->Size(), "bytevector-search: index out of range");
+
+    auto size = haystack->Size() - start;
+    auto ind = FindBytes(haystack->Data() + start, size, needle->Data(), needle->Size());
+    if (ind == size && needle->Size() != 0) {
+        return GetFalse(scope);
+    }
+
+    return Heap::Instance().Make<Number>(static_cast<int64_t>(start + ind));
+}
+
+IsHashTable::IsHashTable() : Procedure({1, 1, "hash-table?: expected 1 argument"}) {
+}
+
+Object* IsHashTable::Call(FunctionArgs args, Scope* scope) {
+    if (Is<HashTable>(args[0])) {
+        return GetTrue(scope);
+    }
+
+    return GetFalse(scope);
+}
+
+MakeHashTable::MakeHashTable() : Procedure({0, 0, "make-hash-table: expected 0 arguments"}) {
+}
+
+Object* MakeHashTable::Call(FunctionArgs args, Scope*) {
+    return Heap::Instance().Make<HashTable>();
+}
+
+HashTableRef::HashTableRef() : Procedure({2, 3, "hash-table-ref: expected 2 or 3 arguments"}) {
+}
+
+Object* HashTableRef::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(!Is<HashTable>(args[0]),
+                        "hash-table-ref: expected <HashTable> <Key> [<Thunk>]");
+
+    if (auto value = As<HashTable>(args[0])->Find(args[1])) {
+        return *value;
+    }
+    ThrowRuntimeErrorIf(args.Size() == 2, "hash-table-ref: key not found");
+
+    // The optional thunk is called when the key is absent.
+    auto thunk = ToProcedure(args[2], "hash-table-ref: expected <HashTable> <Key> [<Thunk>]");
+    return thunk->Invoke(FunctionArgs(nullptr, nullptr), scope);
+}
+
+HashTableSet::HashTableSet() : Procedure({3, 3, "hash-table-set!: expected 3 arguments"}) {
+}
+
+Object* HashTableSet::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<HashTable>(args[0]),
+                        "hash-table-set!: expected <HashTable> <Key> <Obj>");
+
+    As<HashTable>(args[0])->Set(args[1], args[2]);
+
+    return nullptr;
+}
+
+HashTableDelete::HashTableDelete() : Procedure({2, 2, "hash-table-delete!: expected 2 arguments"}) {
+}
+
+Object* HashTableDelete::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<HashTable>(args[0]),
+                        "hash-table-delete!: expected <HashTable> <Key>");
+
+    As<HashTable>(args[0])->Delete(args[1]);
+
+    return nullptr;
+}
+
+HashTableCount::HashTableCount() : Procedure({1, 1, "hash-table-count: expected 1 argument"}) {
+}
+
+Object* HashTableCount::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<HashTable>(args[0]), "hash-table-count: expected <HashTable>");
+
+    auto count = As<HashTable>(args[0])->Count();
+    return Heap::Instance().Make<Number>(static_cast<int64_t>(count));
+}
+
+HashTableWalk::HashTableWalk() : Procedure({2, 2, "hash-table-walk: expected 2 arguments"}) {
+}
+
+Object* HashTableWalk::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(!Is<HashTable>(args[0]),
+                        "hash-table-walk: expected <HashTable> <Proc>");
+    auto proc = ToProcedure(args[1], "hash-table-walk: expected <HashTable> <Proc>");
+
+    // Entries are copied first, so the procedure may update the table.
+    for (auto [key, value] : As<HashTable>(args[0])->GetEntries()) {
+        std::vector<Object*> call_args{key, value};
+        proc->Invoke(FunctionArgs(call_args), scope);
+    }
+
+    return nullptr;
+}
+
+IsString::IsString() : Procedure({1, 1, "string?: expected 1 argument"}) {
+}
+
+Object* IsString::Call(FunctionArgs args, Scope* scope) {
+    if (Is<String>(args[0])) {
+        return GetTrue(scope);
+    }
+
+    return GetFalse(scope);
+}
+
+StringLength::StringLength() : Procedure({1, 1, "string-length: expected 1 argument"}) {
+}
+
+Object* StringLength::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<String>(args[0]), "string-length: expected <String>");
+
+    auto length = As<String>(args[0])->Length();
+    return Heap::Instance().Make<Number>(static_cast<int64_t>(length));
+}
+
+// There is no character type, a character is a string of length 1.
+StringRef::StringRef() : Procedure({2, 2, "string-ref: expected 2 arguments"}) {
+}
+
+Object* StringRef::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<String>(args[0]) || !Is<Number>(args[1]),
+                        "string-ref: expected <String> <Ind>");
+
+    auto string = As<String>(args[0]);
+    auto ind = ToIndex(As<Number>(args[1]));
+    ThrowRuntimeErrorIf(ind >= string->Length(), "string-ref: index out of range");
+
+    return Heap::Instance().Make<String>(std::string(1, string->GetValue()[ind]));
+}
+
+Substring::Substring() : Procedure({2, 3, "substring: expected 2 or 3 arguments"}) {
+}
+
+Object* Substring::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<String>(args[0]) || !Is<Number>(args[1]) ||
+                            (args.Size() == 3 && !Is<Number>(args[2])),
+                        "substring: expected <String> <Start> [<End>]");
+
+    auto string = As<String>(args[0]);
+    auto start = ToIndex(As<Number>(args[1]));
+    auto end = args.Size() == 3 ? ToIndex(As<Number>(args[2])) : string->Length();
+    ThrowRuntimeErrorIf(start > end || end > string->Length(), "substring: index out of range");
+
+    return Heap::Instance().Make<String>(string->GetValue().substr(start, end - start));
+}
+
+Object* StringEqual::Call(FunctionArgs args, Scope* scope) {
+    for (auto arg : args) {
+        ThrowRuntimeErrorIf(!Is<String>(arg), "string=?: expected strings");
+    }
+
+    for (size_t i = 1; i < args.Size(); ++i) {
+        auto lhs = As<String>(args[i - 1]);
+        auto rhs = As<String>(args[i]);
+        if (lhs->Length() != rhs->Length() || lhs->GetValue() != rhs->GetValue()) {
+            return GetFalse(scope);
+        }
+    }
+
+    return GetTrue(scope);
+}
+
+Object* StringAppend::Call(FunctionArgs args, Scope*) {
+    for (auto arg : args) {
+        ThrowRuntimeErrorIf(!Is<String>(arg), "string-append: expected strings");
+    }
+
+    if (args.Size() == 0) {
+        return Heap::Instance().Make<String>("");
+    }
+    auto result = As<String>(args[0]);
+    for (size_t i = 1; i < args.Size(); ++i) {
+        result = Concatenate(result, As<String>(args[i]));
+    }
+
+    return result;
+}
+
+StringToSymbol::StringToSymbol() : Procedure({1, 1, "string->symbol: expected 1 argument"}) {
+}
+
+Object* StringToSymbol::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<String>(args[0]), "string->symbol: expected <String>");
+
+    return Heap::Instance().Make<Symbol>(As<String>(args[0])->GetValue());
+}
+
+ProfileStart::ProfileStart() : Procedure({0, 1, "profile-start: expected at most 1 argument"}) {
+}
+
+Object* ProfileStart::Call(FunctionArgs args, Scope*) {
+    if (args.Size() == 0) {
+        Profiler::Instance().Start();
+        return nullptr;
+    }
+
+    ThrowRuntimeErrorIf(!Is<Number>(args[0]) || !std::holds_alternative<int64_t>(
+                                                    As<Number>(args[0])->GetValue()),
+                        "profile-start: expected <Integer>");
+    auto interval = std::get<int64_t>(As<Number>(args[0])->GetValue());
+    Profiler::Instance().Start(std::chrono::microseconds(interval));
+    return nullptr;
+}
+
+ProfileStop::ProfileStop() : Procedure({1, 1, "profile-stop: expected 1 argument"}) {
+}
+
+Object* ProfileStop::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<String>(args[0]), "profile-stop: expected <String>");
+
+    Profiler::Instance().Stop(As<String>(args[0])->GetValue());
+    return nullptr;
+}
+
+ConvertNumberToString::ConvertNumberToString()
+    : Procedure({1, 1, "number->string: expected 1 argument"}) {
+}
+
+Object* ConvertNumberToString::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(!Is<Number>(args[0]), "number->string: expected <Number>");
+
+    return Heap::Instance().Make<String>(NumberToString(As<Number>(args[0])->GetValue()));
+}
+
+IsSymbol::IsSymbol() : Procedure({1, 1, "symbol?: expected 1 argument"}) {
+}
+
+Object* IsSymbol::Call(FunctionArgs args, Scope* scope) {
+    if (Is<Symbol>(args[0])) {
+        return GetTrue(scope);
+    }
+
+    return GetFalse(scope);
+}
+
+bool IsSymbol::IsPure() const {
+    return true;
+}
+
+Object* Define::Execute(FunctionArgs args, Scope* scope) {
+    if (bool used_syntax_sugar = Is<Cell>(args[0]); used_syntax_sugar) {
+        ThrowSyntaxErrorIf(args.Size() < 2, "define: lambda sugar");
+        auto vector = ObjectToVector(args[0]);
+        ThrowSyntaxErrorIf(!Is<Symbol>(vector[0]), "define: lambda sugar");
+        const auto& name = As<Symbol>(vector[0])->GetName();
+        auto info = GetLambdaInfo(args.GetHead(), args[0],
+                                  std::vector(vector.begin() + 1, vector.end() - 1),
+                                  std::vector(args.begin() + 1, args.end()));
+        auto func = MakeLambda(std::move(info), scope);
+        As<Lambda>(func)->SetName(name);
+        scope->PutObject(name, func);
+
+    } else {
+        ThrowSyntaxErrorIf(args.Size() != 2, "define: expected 2 arguments");
+        const auto& name = As<Symbol>(args[0])->GetName();
+        auto value = Process(args[1], scope);
+        if (Is<Lambda>(value) && As<Lambda>(value)->GetName().empty()) {
+            As<Lambda>(value)->SetName(name);
+        }
+        scope->PutObject(name, value);
+    }
+
+    return nullptr;
+}
+
+Object* Set::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() != 2, "set!: expected 2 arguments");
+    ThrowRuntimeErrorIf(!Is<Symbol>(args[0]), "set!: expected <Name> <Expr>");
+
+    const auto& name = As<Symbol>(args[0])->GetName();
+    scope->SetObject(name, Process(args[1], scope));
+
+    return nullptr;
+}
+
+Object* SetCar::Call(FunctionArgs args, Scope*) {
+    ThrowSyntaxErrorIf(args.Size() != 2, "set-car!: expected 2 arguments");
+    ThrowRuntimeErrorIf(!Is<Cell>(args[0]), "set-car!: expected pair");
+
+    As<Cell>(args[0])->SetFirst(args[1]);
+
+    return nullptr;
+}
+
+Object* SetCdr::Call(FunctionArgs args, Scope*) {
+    ThrowSyntaxErrorIf(args.Size() != 2, "set-cdr!: expected 2 arguments");
+    ThrowRuntimeErrorIf(!Is<Cell>(args[0]), "set-cdr!: expected pair");
+
+    As<Cell>(args[0])->SetSecond(args[1]);
+
+    return nullptr;
+}
+
+Object* If::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() != 2 && args.Size() != 3,
+                       "if: expected <cond> <true_br> [<false_br>]");
+
+    auto cond = Process(args[0], scope);
+    if (!IsFalse(cond)) {
+        return Process(args[1], scope);
+    }
+
+    if (args.Size() == 3) {
+        return Process(args[2], scope);
+    }
+
+    return nullptr;
+}
+
+Object* CreateLambda::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() < 2, "Invalid lambda syntax");
+
+    auto lambda_params = ObjectToVector(args[0]);
+    lambda_params.pop_back();
+    auto lambda_body = std::vector(args.begin() + 1, args.end());
+
+    auto info = GetLambdaInfo(args.GetHead(), args[0], std::move(lambda_params),
+                              std::move(lambda_body));
+    return MakeLambda(std::move(info), scope);
+}
+
+Object* MakeThunk(Object* head, std::vector<Object*> body, Scope* scope) {
+    return MakeLambda(GetLambdaInfo(head, nullptr, {}, std::move(body)), scope);
+}
+
+namespace {
+// Follows if forms in the tail of a named let body. Returns true with the
+// arguments of a call of the loop, or false with the value of the body.
+bool ProcessLoopTail(Object* expr, Object* loop, Scope* frame, std::vector<Object*>* args,
+                     Object** value) {
+    while (Is<Cell>(expr) && Is<Symbol>(As<Cell>(expr)->GetFirst())) {
+        auto func = ExtractFunction(As<Cell>(expr)->GetFirst(), frame);
+        auto rest = As<Cell>(expr)->GetSecond();
+        if (Is<If>(func)) {
+            auto parts = ObjectToVector(rest);
+            if ((parts.size() != 3 && parts.size() != 4) || parts.back() != nullptr) {
+                break;
+            }
+            if (!IsFalse(Process(parts[0], frame))) {
+                expr = parts[1];
+            } else if (parts.size() == 4) {
+                expr = parts[2];
+            } else {
+                *value = nullptr;
+                return false;
+            }
+            continue;
+        }
+        if (func != loop) {
+            break;
+        }
+        args->clear();
+        for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+            args->push_back(Process(As<Cell>(rest)->GetFirst(), frame));
+        }
+        return true;
+    }
+    *value = Process(expr, frame);
+    return false;
+}
+
+Object* ProcessNamedLet(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() < 3, "let: expected name, bindings and body");
+    const auto& name = As<Symbol>(args[0])->GetName();
+    auto bindings = ParseBindings(args[1], false, "let");
+    auto info = GetFrameInfo(args.GetHead(), args[1], bindings,
+                             std::vector(args.begin() + 2, args.end()));
+
+    // The loop is a closure as well, for calls that are not in tail position.
+    auto& frames = FrameStack::Instance();
+    Scope loop_scope(scope, &frames);
+    auto box = As<Box>(Heap::Instance().Make<Box>());
+    loop_scope.PutLocal(&name, box);
+    auto loop = MakeLambda(info, &loop_scope);
+    As<Lambda>(loop)->SetName(name);
+    box->Set(loop);
+
+    Scope frame(&loop_scope, &frames);
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        BindName(&frame, *info, i, Process(bindings[i].init, scope));
+    }
+    std::vector<Object*> loop_args;
+    PinnedObjects pinned(loop_args);
+    while (true) {
+        Fuel::Burn();
+        ResetDefines(&frame, *info);
+        const auto& body = info->body;
+        ProcessBody(body.begin(), body.end() - 1, &frame);
+        Object* value;
+        if (!ProcessLoopTail(body.back(), loop, &frame, &loop_args, &value)) {
+            return value;
+        }
+        ThrowRuntimeErrorIf(loop_args.size() != bindings.size(),
+                            "lambda: invalid number of arguments");
+        for (size_t i = 0; i < loop_args.size(); ++i) {
+            BindName(&frame, *info, i, loop_args[i]);
+        }
+    }
+}
+}  // namespace
+
+Object* Let::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() < 2, "let: expected bindings and body");
+    if (Is<Symbol>(args[0])) {
+        return ProcessNamedLet(args, scope);
+    }
+
+    auto bindings = ParseBindings(args[0], false, "let");
+    auto info = GetFrameInfo(args.GetHead(), args[0], bindings,
+                             std::vector(args.begin() + 1, args.end()));
+    Scope frame(scope, &FrameStack::Instance());
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        BindName(&frame, *info, i, Process(bindings[i].init, scope));
+    }
+    ResetDefines(&frame, *info);
+    return ProcessBody(args.begin() + 1, args.end(), &frame);
+}
+
+Object* LetStar::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() < 2, "let*: expected bindings and body");
+
+    auto bindings = ParseBindings(args[0], false, "let*");
+    std::vector<Object*> body;
+    for (const auto& binding : bindings) {
+        body.push_back(binding.init);
+    }
+    body.insert(body.end(), args.begin() + 1, args.end());
+    auto info = GetFrameInfo(args.GetHead(), args[0], bindings, std::move(body));
+
+    // Every initial value sees the names bound before it.
+    Scope frame(scope, &FrameStack::Instance());
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        BindName(&frame, *info, i, Process(bindings[i].init, &frame));
+    }
+    ResetDefines(&frame, *info);
+    return ProcessBody(args.begin() + 1, args.end(), &frame);
+}
+
+Object* Letrec::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() < 2, "letrec: expected bindings and body");
+
+    auto bindings = ParseBindings(args[0], false, "letrec");
+    std::vector<Object*> body;
+    for (const auto& binding : bindings) {
+        body.push_back(binding.init);
+    }
+    body.insert(body.end(), args.begin() + 1, args.end());
+    auto info = GetFrameInfo(args.GetHead(), args[0], bindings, std::move(body));
+
+    // Closures among the initial values capture the boxes of the names.
+    Scope frame(scope, &FrameStack::Instance());
+    for (const auto& binding : bindings) {
+        frame.PutLocal(&binding.name->GetName(), Heap::Instance().Make<Box>());
+    }
+    ResetDefines(&frame, *info);
+    for (const auto& binding : bindings) {
+        frame.PutObject(binding.name->GetName(), Process(binding.init, &frame));
+    }
+    return ProcessBody(args.begin() + 1, args.end(), &frame);
+}
+
+Object* Do::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() < 2, "do: expected bindings and test clause");
+
+    auto bindings = ParseBindings(args[0], true, "do");
+    auto clause = ObjectToVector(args[1]);
+    ThrowSyntaxErrorIf(clause.size() < 2 || clause.back() != nullptr, "do: invalid test clause");
+    clause.pop_back();
+
+    std::vector<Object*> body;
+    for (const auto& binding : bindings) {
+        if (binding.step) {
+            body.push_back(*binding.step);
+        }
+    }
+    body.insert(body.end(), clause.begin(), clause.end());
+    body.insert(body.end(), args.begin() + 2, args.end());
+    auto info = GetFrameInfo(args.GetHead(), args[0], bindings, std::move(body));
+
+    Scope frame(scope, &FrameStack::Instance());
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        BindName(&frame, *info, i, Process(bindings[i].init, scope));
+    }
+    // Steps see the values of the previous iteration.
+    std::vector<Object*> steps(bindings.size());
+    PinnedObjects pinned(steps);
+    while (true) {
+        Fuel::Burn();
+        ResetDefines(&frame, *info);
+        if (!IsFalse(Process(clause[0], &frame))) {
+            return ProcessBody(clause.begin() + 1, clause.end(), &frame);
+        }
+        ProcessBody(args.begin() + 2, args.end(), &frame);
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            if (bindings[i].step) {
+                steps[i] = Process(*bindings[i].step, &frame);
+            }
+        }
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            if (bindings[i].step) {
+                BindName(&frame, *info, i, steps[i]);
+            }
+        }
+    }
+}
+
+Lambda::Lambda(std::shared_ptr<const LambdaInfo> info, Captures captures, Scope* global_scope)
+    : Procedure({info->params.size(), info->params.size(), "lambda: invalid number of arguments"}),
+      info_(std::move(info)),
+      captures_(std::move(captures)),
+      global_scope_(global_scope) {
+    for (auto param : info_->params) {
+        AddDependency(param);
+    }
+    for (auto body_expr : info_->body) {
+        AddDependency(body_expr);
+    }
+    for (const auto& [name, obj] : captures_) {
+        AddDependency(obj);
+    }
+    AddDependency(global_scope_);
+}
+
+Lambda::~Lambda() = default;
+
+const std::string& Lambda::GetName() const {
+    return name_;
+}
+
+void Lambda::SetName(const std::string& name) {
+    name_ = name;
+}
+
+Object* Lambda::Call(FunctionArgs args, Scope* scope) {
+    const auto& params = info_->params;
+    Fuel::Burn();
+
+    LambdaSpan<> span(name_, info_->position, &instrumentation_cache_);
+
+    // Calls inside compiled code are attributed to the outermost one.
+    std::optional<ProfiledCall> profiled_call;
+    if (Profiler::Instance().IsActive()) {
+        profiled_call.emplace(name_, info_->position, &profile_generation_, &profile_label_);
+    }
+
+    if (native_code_) {
+        if (auto result = native_code_->Run(args)) {
+            return *result;
+        }
+    } else if (++calls_ == kJitThreshold && IsJitEnabled() && captures_.empty()) {
+        // Closures read captured variables from their frame, compiled code
+        // only knows parameters and globals.
+        native_code_ = CompileLambda(this, params, info_->body, global_scope_);
+    }
+
+    auto& heap = Heap::Instance();
+    Scope cur_scope(global_scope_, &FrameStack::Instance());
+
+    for (const auto& [name, obj] : captures_) {
+        cur_scope.PutLocal(name, obj);
+    }
+    for (size_t i = 0, size = args.Size(); i < size; ++i) {
+        const auto& name = As<Symbol>(params[i])->GetName();
+        cur_scope.PutLocal(&name, info_->boxed_params[i] ? heap.Make<Box>(args[i]) : args[i]);
+    }
+    for (const auto& name : info_->boxed_defines) {
+        cur_scope.PutLocal(&name, heap.Make<Box>());
     }
 
-    Function* res{};
-    for (auto& body_expr : body_) {
-        res = ExtractFunction(body_expr, cur_scope);
+    Object* res{};
+    for (auto& body_expr : info_->body) {
+        res = Process(body_expr, &cur_scope);
     }
 
     return res;
@@ -1,13 +1,35 @@
 #include <garbage_collection.hpp>
 #include <func.hpp>
+#include <control.hpp>
+#include <error.hpp>
+#include <algorithm>
 
 void Heap::MarkAndSweep(Scope* root) {
+    TraceSpan<> span("MarkAndSweep", "gc");
+
+    std::vector<Object*> roots(retained_.begin(), retained_.end());
     if (root) {
         for (const auto& [name, obj] : *root) {
-            obj->Mark();
+            roots.push_back(obj);
         }
     }
+    SetMarked(roots, true);
+
+    if (Generator::PrepareSweep(this)) {
+        Sweep();
+    } else {
+        // Stacks of reachable suspended generators hold objects that
+        // marking does not reach.
+        auto stack_roots = FindStackRoots();
+        SetMarked(stack_roots, true);
+        Sweep();
+        SetMarked(stack_roots, false);
+    }
+
+    SetMarked(roots, false);
+}
 
+void Heap::Sweep() {
     for (auto it = heap_.begin(), end = heap_.end(); it != end;) {
         if (!(*it)->marked_) {
             it = heap_.erase(it);
@@ -15,15 +37,91 @@ void Heap::MarkAndSweep(Scope* root) {
         }
         ++it;
     }
+}
 
-    if (root) {
-        for (const auto& [name, obj] : *root) {
-            obj->Unmark();
+void Heap::SetLimit(size_t objects) {
+    limit_ = objects;
+}
+
+size_t Heap::GetSize() const {
+    return heap_.size();
+}
+
+void Heap::BeginEvaluation(Scope* root, Object* query) {
+    root_ = root;
+    query_ = query;
+}
+
+void Heap::EndEvaluation() {
+    root_ = nullptr;
+    query_ = nullptr;
+}
+
+void Heap::Retain(Object* obj) {
+    retained_.insert(obj);
+}
+
+void Heap::Release(Object* obj) {
+    retained_.erase(retained_.find(obj));
+}
+
+void Heap::Reclaim(Object* allocated) {
+    if (root_ && pauses_ == 0) {
+        TraceSpan<> span("Reclaim", "gc");
+
+        auto roots = FindStackRoots();
+        roots.push_back(allocated);
+        roots.push_back(query_);
+        roots.insert(roots.end(), retained_.begin(), retained_.end());
+        for (const auto& [name, obj] : *root_) {
+            roots.push_back(obj);
+        }
+        SetMarked(roots, true);
+        Sweep();
+        SetMarked(roots, false);
+    }
+    // Collecting at every allocation would make a nearly full heap crawl.
+    ThrowRuntimeErrorIf(heap_.size() + limit_ / 8 > limit_, "Heap limit exceeded");
+}
+
+std::vector<Object*> Heap::FindStackRoots() const {
+    std::vector<Object*> roots;
+    std::vector<const void*> words;
+    Generator::FindRoots(this, &roots, &words);
+
+    // Any word may look like a pointer, only those to objects count.
+    std::sort(words.begin(), words.end());
+    for (const auto& obj : heap_) {
+        if (std::binary_search(words.begin(), words.end(), obj.get())) {
+            roots.push_back(obj.get());
+        }
+    }
+    return roots;
+}
+
+void Heap::SetMarked(const std::vector<Object*>& roots, bool marked) {
+    for (auto obj : roots) {
+        if (obj) {
+            obj->SetMarkedReachable(marked);
         }
     }
 }
 
+CollectionPause::CollectionPause() : heap_(Heap::Instance()) {
+    ++heap_.pauses_;
+}
+
+CollectionPause::~CollectionPause() {
+    --heap_.pauses_;
+}
+
+Heap Heap::main_;
+thread_local Heap* Heap::instance_ = &Heap::main_;
+
 Heap& Heap::Instance() {
-    static auto heap = Heap();
-    return heap;
+    return *instance_;
+}
+
+void Heap::SetInstance(Heap* heap) {
+    instance_ = heap;
 }
@@ -0,0 +1,141 @@
+#include <instrumentation.hpp>
+#include <algorithm>
+#include <memory>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+namespace {
+// Long runs keep the first million events of their trace.
+constexpr size_t kMaxEvents = 1 << 20;
+
+std::string GetTypeName(std::type_index type) {
+#if defined(__GNUG__)
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> name(
+        abi::__cxa_demangle(type.name(), nullptr, nullptr, &status), &std::free);
+    if (status == 0) {
+        return name.get();
+    }
+#endif
+    return type.name();
+}
+
+template <typename Map>
+std::vector<std::pair<typename Map::key_type, uint64_t>> SortByCount(const Map& counts) {
+    std::vector<std::pair<typename Map::key_type, uint64_t>> sorted(counts.begin(),
+                                                                    counts.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+    return sorted;
+}
+
+void WriteEscaped(std::ostream* out, const std::string& value) {
+    for (auto c : value) {
+        if (c == '"' || c == '\\') {
+            *out << '\\';
+        }
+        *out << c;
+    }
+}
+}  // namespace
+
+Instrumentation::Instrumentation() : origin_(Clock::now()) {
+}
+
+Instrumentation& Instrumentation::Instance() {
+    static auto instrumentation = Instrumentation();
+    return instrumentation;
+}
+
+void Instrumentation::CountCall(const std::type_info& type) {
+    ++calls_[type];
+}
+
+void Instrumentation::CountLookup(size_t depth) {
+    if (lookups_.size() <= depth) {
+        lookups_.resize(depth + 1);
+    }
+    ++lookups_[depth];
+}
+
+void Instrumentation::CountInlineCacheHit() {
+    ++inline_cache_hits_;
+}
+
+void Instrumentation::CountAllocation(const std::type_info& type) {
+    ++allocations_[type];
+}
+
+Instrumentation::LambdaCounters* Instrumentation::GetLambdaCounters(const std::string& label) {
+    return &lambdas_[label];
+}
+
+uint64_t Instrumentation::GetGeneration() const {
+    return generation_;
+}
+
+void Instrumentation::AddEvent(const std::string& name, const char* category,
+                               Clock::time_point start, Clock::time_point end) {
+    if (events_.size() == kMaxEvents) {
+        ++dropped_events_;
+        return;
+    }
+    events_.push_back({name, category, start, end});
+}
+
+void Instrumentation::WriteCounters(std::ostream* out) const {
+    for (const auto& [type, count] : SortByCount(calls_)) {
+        *out << "call " << GetTypeName(type) << ' ' << count << '\n';
+    }
+
+    std::vector<std::pair<std::string, LambdaCounters>> lambdas(lambdas_.begin(),
+                                                                lambdas_.end());
+    std::sort(lambdas.begin(), lambdas.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second.time > rhs.second.time;
+    });
+    for (const auto& [label, counters] : lambdas) {
+        auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(counters.time);
+        *out << "lambda " << label << ' ' << counters.calls << ' ' << time.count() << "ns\n";
+    }
+
+    for (size_t depth = 0; depth < lookups_.size(); ++depth) {
+        *out << "lookup-depth " << depth << ' ' << lookups_[depth] << '\n';
+    }
+    *out << "inline-cache-hits " << inline_cache_hits_ << '\n';
+
+    for (const auto& [type, count] : SortByCount(allocations_)) {
+        *out << "allocation " << GetTypeName(type) << ' ' << count << '\n';
+    }
+    *out << "dropped-events " << dropped_events_ << '\n';
+}
+
+void Instrumentation::WriteTrace(std::ostream* out) const {
+    auto microseconds = [this](Clock::time_point time) {
+        return std::chrono::duration<double, std::micro>(time - origin_).count();
+    };
+
+    *out << "{\"traceEvents\": [";
+    for (size_t ind = 0; ind < events_.size(); ++ind) {
+        const auto& event = events_[ind];
+        *out << (ind == 0 ? "\n" : ",\n") << "{\"name\": \"";
+        WriteEscaped(out, event.name);
+        *out << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"ts\": "
+             << microseconds(event.start)
+             << ", \"dur\": " << microseconds(event.end) - microseconds(event.start)
+             << ", \"pid\": 1, \"tid\": 1}";
+    }
+    *out << "\n], \"displayTimeUnit\": \"ns\"}\n";
+}
+
+void Instrumentation::Reset() {
+    ++generation_;
+    calls_.clear();
+    lambdas_.clear();
+    lookups_.clear();
+    inline_cache_hits_ = 0;
+    allocations_.clear();
+    events_.clear();
+    dropped_events_ = 0;
+}
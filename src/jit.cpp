@@ -0,0 +1,766 @@
+#include <jit.hpp>
+#include <error.hpp>
+#include <garbage_collection.hpp>
+#include <array>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define SCHEME_JIT_X86_64
+#endif
+
+namespace {
+bool jit_enabled = true;
+
+using Type = NativeCode::Type;
+}  // namespace
+
+void SetJitEnabled(bool enabled) {
+    jit_enabled = enabled;
+}
+
+bool IsJitEnabled() {
+    return jit_enabled;
+}
+
+// Code pages are written first and then made executable, never both.
+class ExecutableMemory final {
+public:
+    ExecutableMemory(const std::vector<uint8_t>& code) : size_(code.size()) {
+#ifdef SCHEME_JIT_X86_64
+        auto memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return;
+        }
+        std::memcpy(memory, code.data(), size_);
+        if (mprotect(memory, size_, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size_);
+            return;
+        }
+        data_ = memory;
+#endif
+    }
+
+    ExecutableMemory(const ExecutableMemory&) = delete;
+    ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+
+    ~ExecutableMemory() {
+#ifdef SCHEME_JIT_X86_64
+        if (data_) {
+            munmap(data_, size_);
+        }
+#endif
+    }
+
+    void* GetData() const {
+        return data_;
+    }
+
+private:
+    void* data_{};
+    size_t size_;
+};
+
+NativeCode::NativeCode(std::unique_ptr<ExecutableMemory> memory, std::vector<Type> param_types,
+                       Type result_type, Dependencies dependencies, Scope* global_scope)
+    : memory_(std::move(memory)),
+      param_types_(std::move(param_types)),
+      result_type_(result_type),
+      dependencies_(std::move(dependencies)),
+      global_scope_(global_scope),
+      checked_version_(Scope::GetGlobalVersion()) {
+}
+
+NativeCode::~NativeCode() = default;
+
+namespace {
+// Calls that bail out this many times are never run natively again.
+constexpr size_t kMaxBailouts = 16;
+
+// Native recursion gives up before it takes this much machine stack.
+constexpr int32_t kNativeStackLimit = 1 << 19;
+
+constexpr size_t kMaxJitParams = 8;
+
+// Entry point: fills *result and returns 1, or returns 0 after a bailout.
+using Entry = int64_t (*)(const int64_t* args, int64_t* result);
+
+bool IsBooleanSymbol(Object* obj) {
+    return Is<Symbol>(obj) &&
+           (As<Symbol>(obj)->GetName() == "#t" || As<Symbol>(obj)->GetName() == "#f");
+}
+}  // namespace
+
+std::optional<Object*> NativeCode::Run(FunctionArgs args) {
+    if (disabled_ || !jit_enabled || !CheckDependencies()) {
+        return std::nullopt;
+    }
+
+    // Raw fixnums, 0 or 1 for booleans and pointers for everything else.
+    std::array<int64_t, kMaxJitParams> raw_args;
+    for (size_t i = 0; i < param_types_.size(); ++i) {
+        if (param_types_[i] == Type::kInt) {
+            auto value = Is<Number>(args[i]) ? std::get_if<int64_t>(&As<Number>(args[i])->GetValue())
+                                             : nullptr;
+            if (!value) {
+                return std::nullopt;
+            }
+            raw_args[i] = *value;
+        } else if (param_types_[i] == Type::kBool) {
+            if (!IsBooleanSymbol(args[i])) {
+                return std::nullopt;
+            }
+            raw_args[i] = As<Symbol>(args[i])->GetName() == "#t";
+        } else {
+            raw_args[i] = reinterpret_cast<int64_t>(args[i]);
+        }
+    }
+
+    int64_t result;
+    if (!reinterpret_cast<Entry>(memory_->GetData())(raw_args.data(), &result)) {
+        disabled_ = ++bailouts_ == kMaxBailouts;
+        return std::nullopt;
+    }
+
+    switch (result_type_) {
+        case Type::kInt:
+            return Heap::Instance().Make<Number>(result);
+        case Type::kBool:
+            return global_scope_->GetObject(result ? "#t" : "#f");
+        default:
+            return reinterpret_cast<Object*>(result);
+    }
+}
+
+// Global bindings rarely change, so they are only compared again after the
+// global version moves.
+bool NativeCode::CheckDependencies() {
+    auto version = Scope::GetGlobalVersion();
+    if (version == checked_version_) {
+        return true;
+    }
+    for (const auto& [name, value] : dependencies_) {
+        try {
+            if (global_scope_->GetObject(name) != value) {
+                disabled_ = true;
+                return false;
+            }
+        } catch (const NameError&) {
+            disabled_ = true;
+            return false;
+        }
+    }
+    checked_version_ = version;
+    return true;
+}
+
+#ifdef SCHEME_JIT_X86_64
+
+namespace {
+// Helpers called from machine code return the value in rax and whether the
+// guard passed in rdx.
+struct HelperResult {
+    int64_t value;
+    int64_t ok;
+};
+
+HelperResult UnboxFixnum(Object* obj) noexcept {
+    auto value = Is<Number>(obj) ? std::get_if<int64_t>(&As<Number>(obj)->GetValue()) : nullptr;
+    return {value ? *value : 0, value != nullptr};
+}
+
+HelperResult BoxFixnum(int64_t value) noexcept {
+    try {
+        return {reinterpret_cast<int64_t>(Heap::Instance().Make<Number>(value)), 1};
+    } catch (...) {
+        return {0, 0};
+    }
+}
+
+HelperResult LoadCar(Object* obj) noexcept {
+    if (!Is<Cell>(obj)) {
+        return {0, 0};
+    }
+    return {reinterpret_cast<int64_t>(As<Cell>(obj)->GetFirst()), 1};
+}
+
+HelperResult LoadCdr(Object* obj) noexcept {
+    if (!Is<Cell>(obj)) {
+        return {0, 0};
+    }
+    return {reinterpret_cast<int64_t>(As<Cell>(obj)->GetSecond()), 1};
+}
+
+// Minimal x86-64 assembler for the instructions the compiler needs. Jumps
+// and calls use 32-bit displacements patched when their label is bound.
+class Assembler {
+public:
+    struct Label {
+        size_t position{SIZE_MAX};
+        std::vector<size_t> fixups;
+    };
+
+    enum Condition : uint8_t {
+        kOverflow = 0x0,
+        kBelow = 0x2,
+        kEqual = 0x4,
+        kZero = 0x4,
+        kLess = 0xc,
+        kGreaterEqual = 0xd,
+        kLessEqual = 0xe,
+        kGreater = 0xf,
+    };
+
+    void Emit(std::initializer_list<uint8_t> bytes) {
+        code_.insert(code_.end(), bytes);
+    }
+
+    void Emit32(int32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            code_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void Emit64(int64_t value) {
+        Emit32(static_cast<int32_t>(value));
+        Emit32(static_cast<int32_t>(value >> 32));
+    }
+
+    void Bind(Label* label) {
+        label->position = code_.size();
+        for (auto fixup : label->fixups) {
+            Patch(fixup, label->position);
+        }
+        label->fixups.clear();
+    }
+
+    // mov rax, imm64
+    void LoadImmediate(int64_t value) {
+        Emit({0x48, 0xb8});
+        Emit64(value);
+    }
+
+    // mov rax, [rbp + offset]
+    void LoadLocal(int32_t offset) {
+        Emit({0x48, 0x8b, 0x85});
+        Emit32(offset);
+    }
+
+    void PushRax() {
+        Emit({0x50});
+    }
+
+    // mov rcx, rax; pop rax
+    void PopRaxKeepRcx() {
+        Emit({0x48, 0x89, 0xc1, 0x58});
+    }
+
+    // jcc rel32
+    void Jump(Condition condition, Label* label) {
+        Emit({0x0f, static_cast<uint8_t>(0x80 | condition)});
+        EmitTarget(label);
+    }
+
+    // jmp rel32
+    void Jump(Label* label) {
+        Emit({0xe9});
+        EmitTarget(label);
+    }
+
+    // call rel32
+    void Call(Label* label) {
+        Emit({0xe8});
+        EmitTarget(label);
+    }
+
+    // rax = helper(rax), with the stack aligned as the ABI requires.
+    void CallHelper(HelperResult (*helper)(Object*) noexcept) {
+        CallHelperAt(reinterpret_cast<int64_t>(helper));
+    }
+
+    void CallHelper(HelperResult (*helper)(int64_t) noexcept) {
+        CallHelperAt(reinterpret_cast<int64_t>(helper));
+    }
+
+    // add rsp, imm32
+    void DropStack(int32_t size) {
+        if (size != 0) {
+            Emit({0x48, 0x81, 0xc4});
+            Emit32(size);
+        }
+    }
+
+    // cmp rax, rcx; setcc al; movzx eax, al
+    void Compare(Condition condition) {
+        Emit({0x48, 0x39, 0xc8, 0x0f, static_cast<uint8_t>(0x90 | condition), 0xc0, 0x0f, 0xb6,
+              0xc0});
+    }
+
+    const std::vector<uint8_t>& GetCode() const {
+        return code_;
+    }
+
+private:
+    void CallHelperAt(int64_t address) {
+        // mov rdi, rax; mov r14, rsp; and rsp, -16
+        Emit({0x48, 0x89, 0xc7, 0x49, 0x89, 0xe6, 0x48, 0x83, 0xe4, 0xf0});
+        LoadImmediate(address);
+        // call rax; mov rsp, r14
+        Emit({0xff, 0xd0, 0x4c, 0x89, 0xf4});
+    }
+
+    void EmitTarget(Label* label) {
+        auto fixup = code_.size();
+        Emit32(0);
+        if (label->position != SIZE_MAX) {
+            Patch(fixup, label->position);
+        } else {
+            label->fixups.push_back(fixup);
+        }
+    }
+
+    void Patch(size_t fixup, size_t target) {
+        auto displacement = static_cast<int32_t>(target - (fixup + 4));
+        for (int i = 0; i < 4; ++i) {
+            code_[fixup + i] = static_cast<uint8_t>(displacement >> (8 * i));
+        }
+    }
+
+private:
+    std::vector<uint8_t> code_;
+};
+
+enum class Op { kAdd, kSubtract, kMultiply, kCompare, kNot, kIsNull, kCar, kCdr, kIf, kSelf };
+
+struct Form {
+    Op op;
+    std::vector<Object*> args;
+    Assembler::Condition condition{};
+};
+
+// Values live in rax: fixnums unboxed, booleans as 0 or 1, other objects as
+// pointers. Operands wait on the machine stack, so no register allocation is
+// needed. Parameters are pushed by the caller in order and read relative to
+// rbp, the trampoline keeps the bailout stack pointer in rbx and the stack
+// limit in r13.
+class Compiler {
+public:
+    Compiler(Lambda* lambda, const std::vector<Object*>& params, Scope* scope)
+        : lambda_(lambda), scope_(scope), param_types_(params.size(), Type::kUnknown) {
+        for (size_t i = 0; i < params.size(); ++i) {
+            params_[As<Symbol>(params[i])->GetName()] = i;
+        }
+    }
+
+    std::unique_ptr<NativeCode> Compile(Object* body) {
+        if (!Infer(body)) {
+            return nullptr;
+        }
+        EmitTrampoline();
+        assembler_.Bind(&body_);
+        // push rbp; mov rbp, rsp; cmp rsp, r13; jb bail
+        assembler_.Emit({0x55, 0x48, 0x89, 0xe5, 0x4c, 0x39, 0xec});
+        assembler_.Jump(Assembler::kBelow, &bail_);
+        EmitValue(body, result_type_);
+        // pop rbp; ret
+        assembler_.Emit({0x5d, 0xc3});
+
+        auto memory = std::make_unique<ExecutableMemory>(assembler_.GetCode());
+        if (!memory->GetData()) {
+            return nullptr;
+        }
+        Dependencies dependencies(dependencies_.begin(), dependencies_.end());
+        return std::make_unique<NativeCode>(std::move(memory), std::move(param_types_),
+                                            result_type_, std::move(dependencies), scope_);
+    }
+
+private:
+    using Dependencies = NativeCode::Dependencies;
+
+    // Propagates types between parameters, operands and the result until
+    // nothing changes. Parameters nobody constrains hold arbitrary objects.
+    bool Infer(Object* body) {
+        for (int iteration = 0; iteration < 8; ++iteration) {
+            changed_ = false;
+            auto type = Check(body, result_type_);
+            if (!type) {
+                return false;
+            }
+            if (result_type_ == Type::kUnknown && *type != Type::kUnknown) {
+                result_type_ = *type;
+                changed_ = true;
+            }
+            if (!changed_) {
+                break;
+            }
+        }
+        for (auto& type : param_types_) {
+            if (type == Type::kUnknown) {
+                type = Type::kObj;
+            }
+        }
+        return result_type_ != Type::kUnknown && Expect(body, result_type_).has_value();
+    }
+
+    static bool IsConvertible(Type from, Type to) {
+        return from == to || from == Type::kUnknown || to == Type::kUnknown ||
+               (from == Type::kObj && to == Type::kInt) || (from == Type::kInt && to == Type::kObj);
+    }
+
+    std::optional<Type> Expect(Object* expr, Type expected) {
+        auto type = Check(expr, expected);
+        if (!type || !IsConvertible(*type, expected)) {
+            return std::nullopt;
+        }
+        return type;
+    }
+
+    // Returns the natural type of the expression or nothing if it cannot be
+    // compiled. Untyped parameters take the type their first use expects.
+    std::optional<Type> Check(Object* expr, Type expected) {
+        if (Is<Number>(expr)) {
+            if (!std::holds_alternative<int64_t>(As<Number>(expr)->GetValue())) {
+                return std::nullopt;
+            }
+            return Type::kInt;
+        }
+        if (Is<Symbol>(expr)) {
+            auto it = params_.find(As<Symbol>(expr)->GetName());
+            if (it == params_.end()) {
+                return ResolveBoolean(expr) ? std::optional(Type::kBool) : std::nullopt;
+            }
+            auto& type = param_types_[it->second];
+            if (type == Type::kUnknown && expected != Type::kUnknown) {
+                type = expected;
+                changed_ = true;
+            }
+            return type;
+        }
+
+        auto form = Classify(expr);
+        if (!form) {
+            return std::nullopt;
+        }
+        auto& args = form->args;
+        switch (form->op) {
+            case Op::kAdd:
+            case Op::kMultiply:
+            case Op::kSubtract:
+                if (args.empty()) {
+                    return std::nullopt;
+                }
+                for (auto arg : args) {
+                    if (!Expect(arg, Type::kInt)) {
+                        return std::nullopt;
+                    }
+                }
+                return Type::kInt;
+            case Op::kCompare:
+                if (args.size() != 2 || !Expect(args[0], Type::kInt) ||
+                    !Expect(args[1], Type::kInt)) {
+                    return std::nullopt;
+                }
+                return Type::kBool;
+            case Op::kNot:
+                if (args.size() != 1 || !Expect(args[0], Type::kBool)) {
+                    return std::nullopt;
+                }
+                return Type::kBool;
+            case Op::kIsNull:
+                if (args.size() != 1 || !Expect(args[0], Type::kObj)) {
+                    return std::nullopt;
+                }
+                return Type::kBool;
+            case Op::kCar:
+            case Op::kCdr:
+                if (args.size() != 1 || !Expect(args[0], Type::kObj)) {
+                    return std::nullopt;
+                }
+                return Type::kObj;
+            case Op::kIf:
+                return CheckIf(args, expected);
+            case Op::kSelf:
+                if (args.size() != param_types_.size()) {
+                    return std::nullopt;
+                }
+                for (size_t i = 0; i < args.size(); ++i) {
+                    auto type = Expect(args[i], param_types_[i]);
+                    if (!type) {
+                        return std::nullopt;
+                    }
+                    if (param_types_[i] == Type::kUnknown && *type != Type::kUnknown) {
+                        param_types_[i] = *type;
+                        changed_ = true;
+                    }
+                }
+                return result_type_;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<Type> CheckIf(const std::vector<Object*>& args, Type expected) {
+        if (args.size() != 3 || !Expect(args[0], Type::kBool)) {
+            return std::nullopt;
+        }
+        auto then_type = Expect(args[1], expected);
+        auto else_type = Expect(args[2], expected);
+        if (!then_type || !else_type) {
+            return std::nullopt;
+        }
+        if (expected != Type::kUnknown) {
+            return expected;
+        }
+        if (*then_type == Type::kUnknown || *then_type == *else_type) {
+            return else_type;
+        }
+        if (*else_type == Type::kUnknown) {
+            return then_type;
+        }
+        return std::nullopt;
+    }
+
+    Object* Resolve(const std::string& name) {
+        Object* value;
+        try {
+            value = scope_->GetObject(name);
+        } catch (const NameError&) {
+            return nullptr;
+        }
+        dependencies_.emplace(name, value);
+        return value;
+    }
+
+    // #t and #f are names bound to boolean symbols like any other.
+    bool ResolveBoolean(Object* symbol) {
+        return IsBooleanSymbol(symbol) && IsBooleanSymbol(Resolve(As<Symbol>(symbol)->GetName()));
+    }
+
+    std::optional<Form> Classify(Object* expr) {
+        auto vector = ObjectToVector(expr);
+        if (vector.back() != nullptr || !Is<Symbol>(vector[0])) {
+            return std::nullopt;
+        }
+        const auto& name = As<Symbol>(vector[0])->GetName();
+        if (params_.contains(name)) {
+            return std::nullopt;
+        }
+        auto func = Resolve(name);
+        Form form{Op::kAdd, std::vector(vector.begin() + 1, vector.end() - 1)};
+        if (func == lambda_) {
+            form.op = Op::kSelf;
+        } else if (Is<Plus>(func)) {
+            form.op = Op::kAdd;
+        } else if (Is<Minus>(func)) {
+            form.op = Op::kSubtract;
+        } else if (Is<Multiply>(func)) {
+            form.op = Op::kMultiply;
+        } else if (Is<Equal>(func)) {
+            form = {Op::kCompare, std::move(form.args), Assembler::kEqual};
+        } else if (Is<MonotonicallyIncreasing>(func)) {
+            form = {Op::kCompare, std::move(form.args), Assembler::kLess};
+        } else if (Is<MonotonicallyDecreasing>(func)) {
+            form = {Op::kCompare, std::move(form.args), Assembler::kGreater};
+        } else if (Is<MonotonicallyNonDecreasing>(func)) {
+            form = {Op::kCompare, std::move(form.args), Assembler::kLessEqual};
+        } else if (Is<MonotonicallyNonIncreasing>(func)) {
+            form = {Op::kCompare, std::move(form.args), Assembler::kGreaterEqual};
+        } else if (Is<Not>(func)) {
+            form.op = Op::kNot;
+        } else if (Is<IsNull>(func)) {
+            form.op = Op::kIsNull;
+        } else if (Is<Car>(func)) {
+            form.op = Op::kCar;
+        } else if (Is<Cdr>(func)) {
+            form.op = Op::kCdr;
+        } else if (Is<If>(func)) {
+            form.op = Op::kIf;
+        } else {
+            return std::nullopt;
+        }
+        return form;
+    }
+
+    // int64_t entry(const int64_t* args, int64_t* result)
+    void EmitTrampoline() {
+        // push rbp; mov rbp, rsp; push rbx; push r12; push r13; push r14
+        assembler_.Emit({0x55, 0x48, 0x89, 0xe5, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56});
+        // mov r12, rsi; mov rbx, rsp; lea r13, [rsp - limit]
+        assembler_.Emit({0x49, 0x89, 0xf4, 0x48, 0x89, 0xe3, 0x4c, 0x8d, 0xac, 0x24});
+        assembler_.Emit32(-kNativeStackLimit);
+        for (size_t i = 0; i < param_types_.size(); ++i) {
+            // push qword [rdi + 8 * i]
+            assembler_.Emit({0xff, 0xb7});
+            assembler_.Emit32(static_cast<int32_t>(8 * i));
+        }
+        assembler_.Call(&body_);
+        assembler_.DropStack(static_cast<int32_t>(8 * param_types_.size()));
+        // mov [r12], rax; mov eax, 1
+        assembler_.Emit({0x49, 0x89, 0x04, 0x24, 0xb8, 0x01, 0x00, 0x00, 0x00});
+
+        Assembler::Label exit;
+        assembler_.Bind(&exit);
+        // pop r14; pop r13; pop r12; pop rbx; pop rbp; ret
+        assembler_.Emit({0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0x5d, 0xc3});
+
+        assembler_.Bind(&bail_);
+        // mov rsp, rbx; xor eax, eax
+        assembler_.Emit({0x48, 0x89, 0xdc, 0x31, 0xc0});
+        assembler_.Jump(&exit);
+    }
+
+    // Leaves the value of the expression converted to the wanted type in rax.
+    void EmitValue(Object* expr, Type wanted) {
+        Convert(EmitNatural(expr, wanted), wanted);
+    }
+
+    void Convert(Type from, Type to) {
+        if (from == Type::kObj && to == Type::kInt) {
+            assembler_.CallHelper(UnboxFixnum);
+            EmitGuard();
+        } else if (from == Type::kInt && to == Type::kObj) {
+            assembler_.CallHelper(BoxFixnum);
+            EmitGuard();
+        }
+    }
+
+    // test rdx, rdx; jz bail
+    void EmitGuard() {
+        assembler_.Emit({0x48, 0x85, 0xd2});
+        assembler_.Jump(Assembler::kZero, &bail_);
+    }
+
+    Type EmitNatural(Object* expr, Type wanted) {
+        if (Is<Number>(expr)) {
+            assembler_.LoadImmediate(std::get<int64_t>(As<Number>(expr)->GetValue()));
+            return Type::kInt;
+        }
+        if (Is<Symbol>(expr)) {
+            auto it = params_.find(As<Symbol>(expr)->GetName());
+            if (it == params_.end()) {
+                auto value = scope_->GetObject(As<Symbol>(expr)->GetName());
+                assembler_.LoadImmediate(As<Symbol>(value)->GetName() == "#t");
+                return Type::kBool;
+            }
+            auto offset = 16 + 8 * (param_types_.size() - 1 - it->second);
+            assembler_.LoadLocal(static_cast<int32_t>(offset));
+            return param_types_[it->second];
+        }
+
+        auto form = *Classify(expr);
+        auto& args = form.args;
+        switch (form.op) {
+            case Op::kAdd:
+            case Op::kSubtract:
+            case Op::kMultiply:
+                EmitArithmetic(form);
+                return Type::kInt;
+            case Op::kCompare:
+                EmitValue(args[0], Type::kInt);
+                assembler_.PushRax();
+                EmitValue(args[1], Type::kInt);
+                assembler_.PopRaxKeepRcx();
+                assembler_.Compare(form.condition);
+                return Type::kBool;
+            case Op::kNot:
+                EmitValue(args[0], Type::kBool);
+                // xor eax, 1
+                assembler_.Emit({0x83, 0xf0, 0x01});
+                return Type::kBool;
+            case Op::kIsNull:
+                EmitValue(args[0], Type::kObj);
+                // test rax, rax; setz al; movzx eax, al
+                assembler_.Emit({0x48, 0x85, 0xc0, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0});
+                return Type::kBool;
+            case Op::kCar:
+            case Op::kCdr:
+                EmitValue(args[0], Type::kObj);
+                assembler_.CallHelper(form.op == Op::kCar ? LoadCar : LoadCdr);
+                EmitGuard();
+                return Type::kObj;
+            case Op::kIf: {
+                Assembler::Label else_branch;
+                Assembler::Label end;
+                EmitValue(args[0], Type::kBool);
+                // test rax, rax
+                assembler_.Emit({0x48, 0x85, 0xc0});
+                assembler_.Jump(Assembler::kZero, &else_branch);
+                EmitValue(args[1], wanted);
+                assembler_.Jump(&end);
+                assembler_.Bind(&else_branch);
+                EmitValue(args[2], wanted);
+                assembler_.Bind(&end);
+                return wanted;
+            }
+            case Op::kSelf:
+                for (size_t i = 0; i < args.size(); ++i) {
+                    EmitValue(args[i], param_types_[i]);
+                    assembler_.PushRax();
+                }
+                assembler_.Call(&body_);
+                assembler_.DropStack(static_cast<int32_t>(8 * args.size()));
+                return result_type_;
+        }
+        return wanted;
+    }
+
+    // Overflow leaves the result to the interpreter, which promotes it.
+    void EmitArithmetic(const Form& form) {
+        const auto& args = form.args;
+        // Like the interpreter, a single operand is returned as is, even by -.
+        EmitValue(args[0], Type::kInt);
+        for (size_t i = 1; i < args.size(); ++i) {
+            assembler_.PushRax();
+            EmitValue(args[i], Type::kInt);
+            assembler_.PopRaxKeepRcx();
+            if (form.op == Op::kAdd) {
+                // add rax, rcx
+                assembler_.Emit({0x48, 0x01, 0xc8});
+            } else if (form.op == Op::kSubtract) {
+                // sub rax, rcx
+                assembler_.Emit({0x48, 0x29, 0xc8});
+            } else {
+                // imul rax, rcx
+                assembler_.Emit({0x48, 0x0f, 0xaf, 0xc1});
+            }
+            assembler_.Jump(Assembler::kOverflow, &bail_);
+        }
+    }
+
+private:
+    Lambda* lambda_;
+    Scope* scope_;
+    std::unordered_map<std::string, size_t> params_;
+    std::vector<Type> param_types_;
+    Type result_type_{Type::kUnknown};
+    bool changed_{false};
+    std::unordered_map<std::string, Object*> dependencies_;
+
+    Assembler assembler_;
+    Assembler::Label body_;
+    Assembler::Label bail_;
+};
+}  // namespace
+
+std::unique_ptr<NativeCode> CompileLambda(Lambda* lambda, const std::vector<Object*>& params,
+                                          const std::vector<Object*>& body, Scope* scope) {
+    // Closures may see bindings of enclosing frames, which are not versioned.
+    if (body.size() != 1 || params.size() > kMaxJitParams || !scope->IsGlobal()) {
+        return nullptr;
+    }
+    for (auto param : params) {
+        if (!Is<Symbol>(param)) {
+            return nullptr;
+        }
+    }
+    return Compiler(lambda, params, scope).Compile(body[0]);
+}
+
+#else
+
+std::unique_ptr<NativeCode> CompileLambda(Lambda*, const std::vector<Object*>&,
+                                          const std::vector<Object*>&, Scope*) {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,486 @@
+#include <macro.hpp>
+#include <error.hpp>
+#include <garbage_collection.hpp>
+#include <atomic>
+#include <unordered_map>
+
+namespace {
+using Names = std::unordered_set<std::string>;
+
+// Match of a pattern variable. Variables under an ellipsis have one item per
+// repetition instead of a value.
+struct Binding {
+    Object* value{};
+    bool repeated{false};
+    std::vector<Binding> items;
+};
+
+using Bindings = std::unordered_map<std::string, Binding>;
+
+// Fresh names of the binders of one expansion.
+using Renames = std::unordered_map<std::string, std::string>;
+
+bool IsNamed(Object* obj, std::string_view name) {
+    return Is<Symbol>(obj) && As<Symbol>(obj)->GetName() == name;
+}
+
+Object* First(Object* obj) {
+    return Is<Cell>(obj) ? As<Cell>(obj)->GetFirst() : nullptr;
+}
+
+Object* Rest(Object* obj) {
+    return Is<Cell>(obj) ? As<Cell>(obj)->GetSecond() : nullptr;
+}
+
+bool IsPatternVariable(Object* obj, const Names& literals) {
+    if (!Is<Symbol>(obj)) {
+        return false;
+    }
+    const auto& name = As<Symbol>(obj)->GetName();
+    return name != "_" && name != "..." && name != "#t" && name != "#f" &&
+           !literals.contains(name);
+}
+
+void CollectPatternVariables(Object* pattern, const Names& literals, Names* variables) {
+    if (IsPatternVariable(pattern, literals)) {
+        variables->insert(As<Symbol>(pattern)->GetName());
+    } else if (Is<Cell>(pattern)) {
+        for (auto item : ObjectToVector(pattern)) {
+            CollectPatternVariables(item, literals, variables);
+        }
+    } else if (Is<Vector>(pattern)) {
+        for (size_t i = 0; i < As<Vector>(pattern)->Size(); ++i) {
+            CollectPatternVariables(As<Vector>(pattern)->Get(i), literals, variables);
+        }
+    }
+}
+
+// Items of a list or vector followed by the tail of a list.
+std::vector<Object*> ToItems(Object* obj) {
+    if (!Is<Vector>(obj)) {
+        return ObjectToVector(obj);
+    }
+    std::vector<Object*> items;
+    for (size_t i = 0; i < As<Vector>(obj)->Size(); ++i) {
+        items.push_back(As<Vector>(obj)->Get(i));
+    }
+    items.push_back(nullptr);
+    return items;
+}
+
+// Returns the index of the item followed by an ellipsis or the size.
+size_t FindEllipsis(const std::vector<Object*>& items) {
+    for (size_t i = 0; i + 2 < items.size(); ++i) {
+        if (IsNamed(items[i + 1], "...")) {
+            return i;
+        }
+    }
+    return items.size();
+}
+
+bool Match(Object* pattern, Object* form, const Names& literals, Bindings* bindings);
+
+// Matches items of a list or vector, the last item of both is the tail.
+bool MatchItems(const std::vector<Object*>& patterns, const std::vector<Object*>& forms,
+                const Names& literals, Bindings* bindings) {
+    auto ellipsis = FindEllipsis(patterns);
+    if (ellipsis == patterns.size()) {
+        auto count = patterns.size() - 1;
+        if (forms.size() < patterns.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (!Match(patterns[i], forms[i], literals, bindings)) {
+                return false;
+            }
+        }
+        // A dotted pattern matches the rest of the list.
+        auto rest = VectorToObject(std::vector(forms.begin() + count, forms.end()));
+        return Match(patterns.back(), rest, literals, bindings);
+    }
+
+    auto after = patterns.size() - ellipsis - 3;
+    if (forms.size() - 1 < ellipsis + after) {
+        return false;
+    }
+    auto repeated_end = forms.size() - 1 - after;
+    for (size_t i = 0; i < ellipsis; ++i) {
+        if (!Match(patterns[i], forms[i], literals, bindings)) {
+            return false;
+        }
+    }
+
+    Names variables;
+    CollectPatternVariables(patterns[ellipsis], literals, &variables);
+    for (const auto& name : variables) {
+        (*bindings)[name] = Binding{nullptr, true, {}};
+    }
+    for (size_t i = ellipsis; i < repeated_end; ++i) {
+        Bindings item;
+        if (!Match(patterns[ellipsis], forms[i], literals, &item)) {
+            return false;
+        }
+        for (const auto& name : variables) {
+            (*bindings)[name].items.push_back(std::move(item[name]));
+        }
+    }
+
+    for (size_t i = 0; i < after; ++i) {
+        if (!Match(patterns[ellipsis + 2 + i], forms[repeated_end + i], literals, bindings)) {
+            return false;
+        }
+    }
+    return Match(patterns.back(), forms.back(), literals, bindings);
+}
+
+bool Match(Object* pattern, Object* form, const Names& literals, Bindings* bindings) {
+    if (Is<Symbol>(pattern)) {
+        if (IsPatternVariable(pattern, literals)) {
+            (*bindings)[As<Symbol>(pattern)->GetName()] = Binding{form};
+            return true;
+        }
+        return IsNamed(pattern, "_") || IsNamed(form, As<Symbol>(pattern)->GetName());
+    }
+    if (Is<Cell>(pattern)) {
+        return (Is<Cell>(form) || form == nullptr) &&
+               MatchItems(ObjectToVector(pattern), ObjectToVector(form), literals, bindings);
+    }
+    if (Is<Vector>(pattern)) {
+        return Is<Vector>(form) && MatchItems(ToItems(pattern), ToItems(form), literals, bindings);
+    }
+    if (Is<Number>(pattern)) {
+        return Is<Number>(form) && As<Number>(pattern)->GetValue() == As<Number>(form)->GetValue();
+    }
+    if (Is<String>(pattern)) {
+        return Is<String>(form) && As<String>(pattern)->GetValue() == As<String>(form)->GetValue();
+    }
+    return pattern == form;
+}
+
+void CollectSymbols(Object* obj, Names* names) {
+    if (Is<Symbol>(obj)) {
+        names->insert(As<Symbol>(obj)->GetName());
+    } else if (Is<Cell>(obj) || Is<Vector>(obj)) {
+        for (auto item : ToItems(obj)) {
+            CollectSymbols(item, names);
+        }
+    }
+}
+
+Object* Instantiate(Object* templ, const Bindings& bindings, const Renames& renames);
+
+// Instantiates the template before an ellipsis once per repetition of the
+// variables under the ellipsis it contains.
+void InstantiateRepeated(Object* templ, const Bindings& bindings, const Renames& renames,
+                         std::vector<Object*>* items) {
+    Names names;
+    CollectSymbols(templ, &names);
+    std::vector<const std::string*> repeated;
+    for (const auto& name : names) {
+        if (auto it = bindings.find(name); it != bindings.end() && it->second.repeated) {
+            repeated.push_back(&it->first);
+        }
+    }
+    ThrowSyntaxErrorIf(repeated.empty(), "syntax-rules: no pattern variable before ellipsis");
+
+    auto count = bindings.at(*repeated[0]).items.size();
+    for (auto name : repeated) {
+        ThrowSyntaxErrorIf(bindings.at(*name).items.size() != count,
+                           "syntax-rules: mismatched repetitions of " + *name);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        auto inner = bindings;
+        for (auto name : repeated) {
+            inner[*name] = bindings.at(*name).items[i];
+        }
+        items->push_back(Instantiate(templ, inner, renames));
+    }
+}
+
+Object* Instantiate(Object* templ, const Bindings& bindings, const Renames& renames) {
+    if (Is<Symbol>(templ)) {
+        const auto& name = As<Symbol>(templ)->GetName();
+        if (auto it = bindings.find(name); it != bindings.end()) {
+            ThrowSyntaxErrorIf(it->second.repeated, "syntax-rules: missing ellipsis after " + name);
+            return it->second.value;
+        }
+        // Every occurrence is a new symbol, like the reader makes them, so
+        // that caches on head symbols stay per call site.
+        auto position = As<Symbol>(templ)->GetPosition();
+        if (auto it = renames.find(name); it != renames.end()) {
+            return Heap::Instance().Make<Symbol>(it->second, position);
+        }
+        return Heap::Instance().Make<Symbol>(name, position);
+    }
+    if (!Is<Cell>(templ) && !Is<Vector>(templ)) {
+        return templ;
+    }
+
+    auto templates = ToItems(templ);
+    std::vector<Object*> items;
+    for (size_t i = 0; i + 1 < templates.size(); ++i) {
+        if (i + 2 < templates.size() && IsNamed(templates[i + 1], "...")) {
+            InstantiateRepeated(templates[i], bindings, renames, &items);
+            ++i;
+        } else {
+            items.push_back(Instantiate(templates[i], bindings, renames));
+        }
+    }
+    if (Is<Vector>(templ)) {
+        return Heap::Instance().Make<Vector>(std::move(items));
+    }
+    items.push_back(Instantiate(templates.back(), bindings, renames));
+    return VectorToObject(items);
+}
+
+void CollectParams(Object* params, Names* binders) {
+    for (; Is<Cell>(params); params = As<Cell>(params)->GetSecond()) {
+        if (Is<Symbol>(First(params))) {
+            binders->insert(As<Symbol>(First(params))->GetName());
+        }
+    }
+    if (Is<Symbol>(params)) {
+        binders->insert(As<Symbol>(params)->GetName());
+    }
+}
+
+// Names bound by lambda and binding forms of a template.
+void CollectBinders(Object* templ, Names* binders) {
+    if (!Is<Cell>(templ)) {
+        return;
+    }
+    auto head = First(templ);
+    auto rest = Rest(templ);
+    if (IsNamed(head, "lambda")) {
+        CollectParams(First(rest), binders);
+    } else if (IsNamed(head, "let") || IsNamed(head, "let*") || IsNamed(head, "letrec") ||
+               IsNamed(head, "do")) {
+        if (Is<Symbol>(First(rest))) {
+            binders->insert(As<Symbol>(First(rest))->GetName());
+            rest = Rest(rest);
+        }
+        for (auto binding : ObjectToVector(First(rest))) {
+            if (Is<Symbol>(First(binding))) {
+                binders->insert(As<Symbol>(First(binding))->GetName());
+            }
+        }
+    }
+    for (auto item : ObjectToVector(templ)) {
+        CollectBinders(item, binders);
+    }
+}
+
+// Renamed binders contain a space, which the reader never puts in a name.
+Renames MakeRenames(const Names& names) {
+    static std::atomic<uint64_t> counter = 0;
+    Renames renames;
+    for (const auto& name : names) {
+        renames.emplace(name, name + " " + std::to_string(++counter));
+    }
+    return renames;
+}
+
+// Walks a query and replaces macro uses with their expansions. Names bound
+// by lambdas and binding forms hide macros of the same name.
+class Expander {
+public:
+    explicit Expander(Scope* global_scope) : global_scope_(global_scope) {
+    }
+
+    Object* Expand(Object* obj, const Names& bound) {
+        obj = ExpandUse(obj, bound);
+        if (!Is<Cell>(obj)) {
+            return obj;
+        }
+        auto head = First(obj);
+        auto rest = Rest(obj);
+        if (Is<Symbol>(head) && bound.contains(As<Symbol>(head)->GetName())) {
+            head = nullptr;
+        }
+
+        if (IsNamed(head, "quote") || IsNamed(head, "syntax-rules") ||
+            IsNamed(head, "define-syntax")) {
+            return obj;
+        }
+        if (IsNamed(head, "lambda")) {
+            ExpandLambda(First(rest), Rest(rest), bound);
+        } else if (IsNamed(head, "define") && Is<Cell>(First(rest))) {
+            ExpandLambda(Rest(First(rest)), Rest(rest), bound);
+        } else if (IsNamed(head, "define") || IsNamed(head, "set!")) {
+            ExpandItems(Rest(rest), bound);
+        } else if (IsNamed(head, "let") || IsNamed(head, "let*") || IsNamed(head, "letrec") ||
+                   IsNamed(head, "do")) {
+            ExpandBindings(rest, IsNamed(head, "do"), bound);
+        } else {
+            ExpandItems(obj, bound);
+        }
+        return obj;
+    }
+
+private:
+    // Expands the form as long as it is a macro use.
+    Object* ExpandUse(Object* obj, const Names& bound) {
+        while (auto macro = ResolveMacro(obj, bound)) {
+            obj = macro->Expand(obj);
+        }
+        return obj;
+    }
+
+    SyntaxRules* ResolveMacro(Object* obj, const Names& bound) const {
+        auto head = First(obj);
+        if (!Is<Symbol>(head) || bound.contains(As<Symbol>(head)->GetName())) {
+            return nullptr;
+        }
+        try {
+            return As<SyntaxRules>(global_scope_->GetObject(As<Symbol>(head)->GetName()));
+        } catch (const NameError&) {
+            return nullptr;
+        }
+    }
+
+    void ExpandItems(Object* list, const Names& bound) {
+        for (; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+            auto cell = As<Cell>(list);
+            if (auto expanded = Expand(cell->GetFirst(), bound); expanded != cell->GetFirst()) {
+                cell->SetFirst(expanded);
+            }
+        }
+    }
+
+    // Uses at the top of a body are expanded first, since they may expand
+    // to internal defines, which bind names in the whole body.
+    void ExpandBody(Object* body, Names bound) {
+        for (auto list = body; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+            auto cell = As<Cell>(list);
+            if (auto expanded = ExpandUse(cell->GetFirst(), bound);
+                expanded != cell->GetFirst()) {
+                cell->SetFirst(expanded);
+            }
+            auto form = cell->GetFirst();
+            if (IsNamed(First(form), "define")) {
+                auto target = First(Rest(form));
+                target = Is<Cell>(target) ? First(target) : target;
+                if (Is<Symbol>(target)) {
+                    bound.insert(As<Symbol>(target)->GetName());
+                }
+            }
+        }
+        ExpandItems(body, bound);
+    }
+
+    void ExpandLambda(Object* params, Object* body, Names bound) {
+        CollectParams(params, &bound);
+        ExpandBody(body, std::move(bound));
+    }
+
+    // Binding forms are expanded as if their names were bound everywhere in
+    // them, which leaves uses that an initial value could see to evaluation.
+    void ExpandBindings(Object* rest, bool is_do, Names bound) {
+        if (!is_do && Is<Symbol>(First(rest))) {
+            bound.insert(As<Symbol>(First(rest))->GetName());
+            rest = Rest(rest);
+        }
+        auto bindings = ObjectToVector(First(rest));
+        for (auto binding : bindings) {
+            if (Is<Symbol>(First(binding))) {
+                bound.insert(As<Symbol>(First(binding))->GetName());
+            }
+        }
+        for (auto binding : bindings) {
+            ExpandItems(Rest(binding), bound);
+        }
+        auto body = Rest(rest);
+        if (is_do) {
+            ExpandItems(First(body), bound);
+            body = Rest(body);
+        }
+        ExpandBody(body, std::move(bound));
+    }
+
+private:
+    Scope* global_scope_;
+};
+}  // namespace
+
+SyntaxRules::SyntaxRules(std::unordered_set<std::string> literals, std::vector<Rule> rules)
+    : literals_(std::move(literals)), rules_(std::move(rules)) {
+    for (const auto& rule : rules_) {
+        AddDependency(rule.pattern);
+        AddDependency(rule.templ);
+    }
+}
+
+Object* SyntaxRules::Execute(FunctionArgs args, Scope* scope) {
+    auto head = As<Symbol>(args.GetHead());
+    auto expansion = head ? head->GetExpansion(this) : nullptr;
+    if (!expansion) {
+        // Matching and instantiating keep new forms in containers.
+        CollectionPause pause;
+        std::vector<Object*> rest(args.begin(), args.end());
+        rest.push_back(nullptr);
+        auto form = Heap::Instance().Make<Cell>(args.GetHead(), VectorToObject(rest));
+        expansion = Expand(form);
+        if (head) {
+            head->SetExpansion(this, expansion);
+        }
+    }
+    return Process(expansion, scope);
+}
+
+Object* SyntaxRules::Expand(Object* form) const {
+    for (const auto& rule : rules_) {
+        Bindings bindings;
+        if (Match(Rest(rule.pattern), Rest(form), literals_, &bindings)) {
+            return Instantiate(rule.templ, bindings, MakeRenames(rule.renamed));
+        }
+    }
+    throw SyntaxError((name_.empty() ? "syntax-rules" : name_) + ": no matching syntax rule");
+}
+
+void SyntaxRules::SetName(const std::string& name) {
+    name_ = name;
+}
+
+Object* CreateSyntaxRules::Execute(FunctionArgs args, Scope*) {
+    ThrowSyntaxErrorIf(args.Size() < 1, "syntax-rules: expected literals and rules");
+
+    std::unordered_set<std::string> literals;
+    auto literals_list = ObjectToVector(args[0]);
+    ThrowSyntaxErrorIf(literals_list.back() != nullptr, "syntax-rules: invalid literals");
+    for (size_t i = 0; i + 1 < literals_list.size(); ++i) {
+        ThrowSyntaxErrorIf(!Is<Symbol>(literals_list[i]), "syntax-rules: invalid literals");
+        literals.insert(As<Symbol>(literals_list[i])->GetName());
+    }
+
+    std::vector<SyntaxRules::Rule> rules;
+    for (size_t i = 1; i < args.Size(); ++i) {
+        auto rule = ObjectToVector(args[i]);
+        ThrowSyntaxErrorIf(rule.size() != 3 || rule.back() != nullptr || !Is<Cell>(rule[0]),
+                           "syntax-rules: expected (pattern template)");
+        Names variables;
+        CollectPatternVariables(Rest(rule[0]), literals, &variables);
+        Names binders;
+        CollectBinders(rule[1], &binders);
+        std::erase_if(binders, [&variables](const auto& name) {
+            return variables.contains(name) || name == "..." || name == "_";
+        });
+        rules.push_back({rule[0], rule[1], std::move(binders)});
+    }
+    return Heap::Instance().Make<SyntaxRules>(std::move(literals), std::move(rules));
+}
+
+Object* DefineSyntax::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() != 2 || !Is<Symbol>(args[0]),
+                       "define-syntax: expected <Name> <Transformer>");
+    ThrowSyntaxErrorIf(!scope->IsGlobal(), "define-syntax: allowed at top level only");
+
+    auto macro = As<SyntaxRules>(Process(args[1], scope));
+    ThrowSyntaxErrorIf(!macro, "define-syntax: expected syntax-rules");
+    macro->SetName(As<Symbol>(args[0])->GetName());
+    scope->PutObject(As<Symbol>(args[0])->GetName(), macro);
+    return nullptr;
+}
+
+Object* ExpandMacros(Object* obj, Scope* global_scope) {
+    return Expander(global_scope).Expand(obj, {});
+}
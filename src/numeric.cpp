@@ -0,0 +1,610 @@
+#include <numeric.hpp>
+#include <error.hpp>
+#include <visitor_helper.hpp>
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+
+namespace {
+using Limb = BigInteger::Limb;
+using Limbs = BigInteger::Limbs;
+
+constexpr size_t kLimbBits = 32;
+constexpr uint64_t kLimbBase = uint64_t{1} << kLimbBits;
+// Below this operand size schoolbook multiplication is faster.
+constexpr size_t kKaratsubaThreshold = 32;
+// The largest power of ten that fits into a limb.
+constexpr Limb kDecimalBase = 1'000'000'000;
+constexpr size_t kDecimalBaseDigits = 9;
+
+void Trim(Limbs* limbs) {
+    while (!limbs->empty() && limbs->back() == 0) {
+        limbs->pop_back();
+    }
+}
+
+int CompareMagnitudes(const Limbs& lhs, const Limbs& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size() ? -1 : 1;
+    }
+    for (size_t i = lhs.size(); i-- > 0;) {
+        if (lhs[i] != rhs[i]) {
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// Adds value * base^shift to the accumulator in place.
+void AddShifted(Limbs* acc, const Limbs& value, size_t shift) {
+    if (acc->size() < value.size() + shift) {
+        acc->resize(value.size() + shift, 0);
+    }
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < value.size(); ++i) {
+        uint64_t sum = uint64_t{(*acc)[i + shift]} + value[i] + carry;
+        (*acc)[i + shift] = static_cast<Limb>(sum);
+        carry = sum >> kLimbBits;
+    }
+    for (i += shift; carry != 0; ++i) {
+        if (i == acc->size()) {
+            acc->push_back(0);
+        }
+        uint64_t sum = uint64_t{(*acc)[i]} + carry;
+        (*acc)[i] = static_cast<Limb>(sum);
+        carry = sum >> kLimbBits;
+    }
+}
+
+Limbs AddMagnitudes(const Limbs& lhs, const Limbs& rhs) {
+    auto result = lhs;
+    AddShifted(&result, rhs, 0);
+    return result;
+}
+
+// Subtracts rhs from acc in place, requires acc >= rhs.
+void SubtractInPlace(Limbs* acc, const Limbs& rhs) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < acc->size(); ++i) {
+        int64_t diff = int64_t{(*acc)[i]} - borrow - (i < rhs.size() ? int64_t{rhs[i]} : 0);
+        borrow = diff < 0 ? 1 : 0;
+        (*acc)[i] = static_cast<Limb>(diff);
+        if (i >= rhs.size() && borrow == 0) {
+            break;
+        }
+    }
+    Trim(acc);
+}
+
+Limbs MultiplySchoolbook(const Limbs& lhs, const Limbs& rhs) {
+    if (lhs.empty() || rhs.empty()) {
+        return {};
+    }
+    Limbs result(lhs.size() + rhs.size(), 0);
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < rhs.size(); ++j) {
+            uint64_t cur = uint64_t{lhs[i]} * rhs[j] + result[i + j] + carry;
+            result[i + j] = static_cast<Limb>(cur);
+            carry = cur >> kLimbBits;
+        }
+        result[i + rhs.size()] = static_cast<Limb>(carry);
+    }
+    Trim(&result);
+    return result;
+}
+
+Limbs Slice(const Limbs& limbs, size_t begin, size_t end) {
+    begin = std::min(begin, limbs.size());
+    end = std::min(end, limbs.size());
+    Limbs result(limbs.begin() + begin, limbs.begin() + end);
+    Trim(&result);
+    return result;
+}
+
+Limbs MultiplyKaratsuba(const Limbs& lhs, const Limbs& rhs) {
+    const auto& small = lhs.size() < rhs.size() ? lhs : rhs;
+    const auto& large = lhs.size() < rhs.size() ? rhs : lhs;
+    if (small.size() < kKaratsubaThreshold) {
+        return MultiplySchoolbook(small, large);
+    }
+
+    // Unbalanced operands are multiplied chunk by chunk of the smaller size.
+    if (2 * small.size() <= large.size()) {
+        Limbs result;
+        for (size_t shift = 0; shift < large.size(); shift += small.size()) {
+            auto chunk = Slice(large, shift, shift + small.size());
+            AddShifted(&result, MultiplyKaratsuba(chunk, small), shift);
+        }
+        Trim(&result);
+        return result;
+    }
+
+    // (a1 B + a0)(b1 B + b0) = z2 B^2 + ((a0 + a1)(b0 + b1) - z2 - z0) B + z0
+    auto half = large.size() / 2;
+    auto a0 = Slice(large, 0, half);
+    auto a1 = Slice(large, half, large.size());
+    auto b0 = Slice(small, 0, half);
+    auto b1 = Slice(small, half, small.size());
+
+    auto z0 = MultiplyKaratsuba(a0, b0);
+    auto z2 = MultiplyKaratsuba(a1, b1);
+    auto z1 = MultiplyKaratsuba(AddMagnitudes(a0, a1), AddMagnitudes(b0, b1));
+    SubtractInPlace(&z1, z0);
+    SubtractInPlace(&z1, z2);
+
+    auto result = z0;
+    AddShifted(&result, z1, half);
+    AddShifted(&result, z2, 2 * half);
+    Trim(&result);
+    return result;
+}
+
+Limb DivideBySmallInPlace(Limbs* limbs, Limb divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = limbs->size(); i-- > 0;) {
+        uint64_t cur = (remainder << kLimbBits) | (*limbs)[i];
+        (*limbs)[i] = static_cast<Limb>(cur / divisor);
+        remainder = cur % divisor;
+    }
+    Trim(limbs);
+    return static_cast<Limb>(remainder);
+}
+
+Limbs ShiftLeft(const Limbs& limbs, int shift, size_t size) {
+    Limbs result(size, 0);
+    for (size_t i = 0; i < limbs.size(); ++i) {
+        uint64_t cur = uint64_t{limbs[i]} << shift;
+        result[i] |= static_cast<Limb>(cur);
+        if (i + 1 < size) {
+            result[i + 1] |= static_cast<Limb>(cur >> kLimbBits);
+        }
+    }
+    return result;
+}
+
+// Knuth's algorithm D, returns the quotient of the magnitudes.
+Limbs DivideMagnitudes(const Limbs& dividend, const Limbs& divisor) {
+    if (CompareMagnitudes(dividend, divisor) < 0) {
+        return {};
+    }
+    if (divisor.size() == 1) {
+        auto quotient = dividend;
+        DivideBySmallInPlace(&quotient, divisor[0]);
+        return quotient;
+    }
+
+    auto shift = std::countl_zero(divisor.back());
+    auto n = divisor.size();
+    auto m = dividend.size() - n;
+    auto v = ShiftLeft(divisor, shift, n);
+    auto u = ShiftLeft(dividend, shift, dividend.size() + 1);
+    Limbs quotient(m + 1, 0);
+
+    for (size_t j = m + 1; j-- > 0;) {
+        uint64_t numerator = (uint64_t{u[j + n]} << kLimbBits) | u[j + n - 1];
+        uint64_t qhat = numerator / v[n - 1];
+        uint64_t rhat = numerator % v[n - 1];
+        while (qhat >= kLimbBase || qhat * v[n - 2] > ((rhat << kLimbBits) | u[j + n - 2])) {
+            --qhat;
+            rhat += v[n - 1];
+            if (rhat >= kLimbBase) {
+                break;
+            }
+        }
+
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t product = qhat * v[i] + carry;
+            carry = product >> kLimbBits;
+            int64_t diff = int64_t{u[i + j]} - borrow - static_cast<int64_t>(product & (kLimbBase - 1));
+            u[i + j] = static_cast<Limb>(diff);
+            borrow = diff < 0 ? 1 : 0;
+        }
+        int64_t diff = int64_t{u[j + n]} - borrow - static_cast<int64_t>(carry);
+        u[j + n] = static_cast<Limb>(diff);
+
+        if (diff < 0) {
+            // qhat was one too large, add the divisor back.
+            --qhat;
+            uint64_t add_carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t sum = uint64_t{u[i + j]} + v[i] + add_carry;
+                u[i + j] = static_cast<Limb>(sum);
+                add_carry = sum >> kLimbBits;
+            }
+            u[j + n] += static_cast<Limb>(add_carry);
+        }
+        quotient[j] = static_cast<Limb>(qhat);
+    }
+
+    Trim(&quotient);
+    return quotient;
+}
+
+BigInteger ToBigInteger(const NumberValue& value) {
+    if (auto fixnum = std::get_if<int64_t>(&value)) {
+        return BigInteger(*fixnum);
+    }
+    return std::get<BigInteger>(value);
+}
+
+NumberValue Normalize(BigInteger value) {
+    if (value.FitsInt64()) {
+        return value.ToInt64();
+    }
+    return value;
+}
+
+// Operation on each kind of number, the fixnum one reports overflow.
+struct ArithmeticKernel {
+    bool (*fixnum)(int64_t, int64_t, int64_t*);
+    BigInteger (*bignum)(const BigInteger&, const BigInteger&);
+    double (*flonum)(double, double);
+};
+
+constexpr ArithmeticKernel kAddKernel{
+    [](int64_t a, int64_t b, int64_t* res) { return !__builtin_add_overflow(a, b, res); },
+    [](const BigInteger& a, const BigInteger& b) { return a + b; },
+    [](double a, double b) { return a + b; }};
+
+constexpr ArithmeticKernel kSubtractKernel{
+    [](int64_t a, int64_t b, int64_t* res) { return !__builtin_sub_overflow(a, b, res); },
+    [](const BigInteger& a, const BigInteger& b) { return a - b; },
+    [](double a, double b) { return a - b; }};
+
+constexpr ArithmeticKernel kMultiplyKernel{
+    [](int64_t a, int64_t b, int64_t* res) { return !__builtin_mul_overflow(a, b, res); },
+    [](const BigInteger& a, const BigInteger& b) { return a * b; },
+    [](double a, double b) { return a * b; }};
+
+constexpr ArithmeticKernel kDivideKernel{
+    [](int64_t a, int64_t b, int64_t* res) {
+        // INT64_MIN / -1 is the only fixnum quotient that overflows.
+        if (a == INT64_MIN && b == -1) {
+            return false;
+        }
+        *res = a / b;
+        return true;
+    },
+    [](const BigInteger& a, const BigInteger& b) { return a / b; },
+    [](double a, double b) { return a / b; }};
+
+enum NumberKind : size_t { kFixnum, kBignum, kFlonum };
+
+// Both operands are promoted to the wider kind, a fixnum result that
+// overflows is recomputed on bignums.
+NumberValue Apply(const ArithmeticKernel& kernel, const NumberValue& lhs,
+                  const NumberValue& rhs) {
+    auto kind = std::max(lhs.index(), rhs.index());
+    if (kind == kFixnum) {
+        if (int64_t result; kernel.fixnum(std::get<int64_t>(lhs), std::get<int64_t>(rhs), &result)) {
+            return result;
+        }
+        kind = kBignum;
+    }
+    if (kind == kBignum) {
+        return Normalize(kernel.bignum(ToBigInteger(lhs), ToBigInteger(rhs)));
+    }
+    return kernel.flonum(ToDouble(lhs), ToDouble(rhs));
+}
+
+// Exact comparison of an exact integer with a flonum.
+std::partial_ordering CompareWithDouble(const NumberValue& exact, double value) {
+    if (std::isnan(value)) {
+        return std::partial_ordering::unordered;
+    }
+    if (std::isinf(value)) {
+        return value > 0 ? std::partial_ordering::less : std::partial_ordering::greater;
+    }
+    // Every integer below 2^53 is exactly representable as a double.
+    constexpr int64_t kExactLimit = int64_t{1} << 53;
+    if (auto fixnum = std::get_if<int64_t>(&exact);
+        fixnum && *fixnum > -kExactLimit && *fixnum < kExactLimit) {
+        return static_cast<double>(*fixnum) <=> value;
+    }
+    auto floor = std::floor(value);
+    if (auto cmp = ToBigInteger(exact) <=> BigInteger::FromDouble(floor); cmp != 0) {
+        return cmp;
+    }
+    return floor < value ? std::partial_ordering::less : std::partial_ordering::equivalent;
+}
+}  // namespace
+
+BigInteger::BigInteger(int64_t value) : negative_(value < 0) {
+    auto magnitude = negative_ ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    while (magnitude != 0) {
+        magnitude_.push_back(static_cast<Limb>(magnitude));
+        magnitude >>= kLimbBits;
+    }
+}
+
+BigInteger::BigInteger(bool negative, Limbs magnitude)
+    : negative_(negative), magnitude_(std::move(magnitude)) {
+    Trim(&magnitude_);
+    if (magnitude_.empty()) {
+        negative_ = false;
+    }
+}
+
+BigInteger BigInteger::Parse(std::string_view literal) {
+    bool negative = false;
+    if (!literal.empty() && (literal[0] == '-' || literal[0] == '+')) {
+        negative = literal[0] == '-';
+        literal.remove_prefix(1);
+    }
+    ThrowSyntaxErrorIf(literal.empty(), "Invalid number literal");
+
+    Limbs magnitude;
+    // The first chunk is shorter so the others have exactly 9 digits.
+    auto chunk_size = literal.size() % kDecimalBaseDigits;
+    if (chunk_size == 0) {
+        chunk_size = kDecimalBaseDigits;
+    }
+    for (size_t pos = 0; pos < literal.size(); pos += chunk_size, chunk_size = kDecimalBaseDigits) {
+        Limb chunk = 0;
+        Limb scale = 1;
+        for (auto digit : literal.substr(pos, chunk_size)) {
+            ThrowSyntaxErrorIf(!std::isdigit(digit), "Invalid number literal");
+            chunk = chunk * 10 + (digit - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (auto& limb : magnitude) {
+            uint64_t cur = uint64_t{limb} * scale + carry;
+            limb = static_cast<Limb>(cur);
+            carry = cur >> kLimbBits;
+        }
+        if (carry != 0) {
+            magnitude.push_back(static_cast<Limb>(carry));
+        }
+    }
+    return BigInteger(negative, std::move(magnitude));
+}
+
+BigInteger BigInteger::FromDouble(double value) {
+    value = std::trunc(value);
+    if (std::fabs(value) < 0x1p63) {
+        return BigInteger(static_cast<int64_t>(value));
+    }
+    // |value| = mantissa * 2^exponent with a 64-bit integer mantissa.
+    int exponent;
+    auto mantissa = static_cast<uint64_t>(std::ldexp(std::frexp(std::fabs(value), &exponent), 64));
+    exponent -= 64;
+
+    Limbs magnitude(exponent / kLimbBits, 0);
+    Limbs mantissa_limbs{static_cast<Limb>(mantissa), static_cast<Limb>(mantissa >> kLimbBits)};
+    auto shifted = ShiftLeft(mantissa_limbs, exponent % kLimbBits, mantissa_limbs.size() + 1);
+    magnitude.insert(magnitude.end(), shifted.begin(), shifted.end());
+    return BigInteger(value < 0, std::move(magnitude));
+}
+
+bool BigInteger::IsNegative() const {
+    return negative_;
+}
+
+bool BigInteger::FitsInt64() const {
+    if (magnitude_.size() > 2) {
+        return false;
+    }
+    uint64_t magnitude = 0;
+    for (size_t i = magnitude_.size(); i-- > 0;) {
+        magnitude = (magnitude << kLimbBits) | magnitude_[i];
+    }
+    auto limit = static_cast<uint64_t>(INT64_MAX) + (negative_ ? 1 : 0);
+    return magnitude <= limit;
+}
+
+int64_t BigInteger::ToInt64() const {
+    uint64_t magnitude = 0;
+    for (size_t i = magnitude_.size(); i-- > 0;) {
+        magnitude = (magnitude << kLimbBits) | magnitude_[i];
+    }
+    return static_cast<int64_t>(negative_ ? 0 - magnitude : magnitude);
+}
+
+double BigInteger::ToDouble() const {
+    double result = 0;
+    for (size_t i = magnitude_.size(); i-- > 0;) {
+        result = result * kLimbBase + magnitude_[i];
+    }
+    return negative_ ? -result : result;
+}
+
+size_t BigInteger::Hash() const {
+    size_t hash = negative_ ? 1 : 0;
+    for (auto limb : magnitude_) {
+        hash = hash * 1000003 + limb;
+    }
+    return hash;
+}
+
+std::string BigInteger::ToString() const {
+    if (magnitude_.empty()) {
+        return "0";
+    }
+    std::vector<Limb> chunks;
+    auto magnitude = magnitude_;
+    while (!magnitude.empty()) {
+        chunks.push_back(DivideBySmallInPlace(&magnitude, kDecimalBase));
+    }
+
+    std::string result = negative_ ? "-" : "";
+    result += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        auto chunk = std::to_string(chunks[i]);
+        result.append(kDecimalBaseDigits - chunk.size(), '0');
+        result += chunk;
+    }
+    return result;
+}
+
+BigInteger BigInteger::operator-() const {
+    return BigInteger(!negative_, magnitude_);
+}
+
+BigInteger operator+(const BigInteger& lhs, const BigInteger& rhs) {
+    if (lhs.negative_ == rhs.negative_) {
+        return BigInteger(lhs.negative_, AddMagnitudes(lhs.magnitude_, rhs.magnitude_));
+    }
+    if (CompareMagnitudes(lhs.magnitude_, rhs.magnitude_) >= 0) {
+        auto magnitude = lhs.magnitude_;
+        SubtractInPlace(&magnitude, rhs.magnitude_);
+        return BigInteger(lhs.negative_, std::move(magnitude));
+    }
+    auto magnitude = rhs.magnitude_;
+    SubtractInPlace(&magnitude, lhs.magnitude_);
+    return BigInteger(rhs.negative_, std::move(magnitude));
+}
+
+BigInteger operator-(const BigInteger& lhs, const BigInteger& rhs) {
+    return lhs + (-rhs);
+}
+
+BigInteger operator*(const BigInteger& lhs, const BigInteger& rhs) {
+    return BigInteger(lhs.negative_ != rhs.negative_,
+                      MultiplyKaratsuba(lhs.magnitude_, rhs.magnitude_));
+}
+
+BigInteger operator/(const BigInteger& lhs, const BigInteger& rhs) {
+    ThrowRuntimeErrorIf(rhs.magnitude_.empty(), "/: division by zero");
+    return BigInteger(lhs.negative_ != rhs.negative_,
+                      DivideMagnitudes(lhs.magnitude_, rhs.magnitude_));
+}
+
+std::strong_ordering operator<=>(const BigInteger& lhs, const BigInteger& rhs) {
+    if (lhs.negative_ != rhs.negative_) {
+        return lhs.negative_ ? std::strong_ordering::less : std::strong_ordering::greater;
+    }
+    auto cmp = CompareMagnitudes(lhs.magnitude_, rhs.magnitude_);
+    if (lhs.negative_) {
+        cmp = -cmp;
+    }
+    return cmp <=> 0;
+}
+
+NumberValue ParseNumber(std::string_view literal) {
+    if (literal == "+inf.0" || literal == "-inf.0") {
+        return literal[0] == '+' ? HUGE_VAL : -HUGE_VAL;
+    }
+    if (literal == "+nan.0" || literal == "-nan.0") {
+        return std::nan("");
+    }
+    if (literal.find_first_of(".eE") == std::string_view::npos) {
+        return Normalize(BigInteger::Parse(literal));
+    }
+
+    if (!literal.empty() && literal[0] == '+') {
+        literal.remove_prefix(1);
+    }
+    double value;
+    auto [end, error] = std::from_chars(literal.data(), literal.data() + literal.size(), value);
+    ThrowSyntaxErrorIf(error != std::errc() || end != literal.data() + literal.size(),
+                       "Invalid number literal");
+    return value;
+}
+
+std::string NumberToString(const NumberValue& value) {
+    if (auto fixnum = std::get_if<int64_t>(&value)) {
+        return std::to_string(*fixnum);
+    }
+    if (auto bignum = std::get_if<BigInteger>(&value)) {
+        return bignum->ToString();
+    }
+
+    auto flonum = std::get<double>(value);
+    if (std::isnan(flonum)) {
+        return "+nan.0";
+    }
+    if (std::isinf(flonum)) {
+        return flonum > 0 ? "+inf.0" : "-inf.0";
+    }
+    // The shortest representation that reads back to the same double, with
+    // a fractional part to tell it from an exact integer.
+    char buffer[32];
+    auto end = std::to_chars(buffer, buffer + sizeof(buffer), flonum).ptr;
+    std::string result(buffer, end);
+    if (result.find_first_of(".e") == std::string::npos) {
+        result += ".0";
+    }
+    return result;
+}
+
+bool IsExact(const NumberValue& value) {
+    return value.index() != kFlonum;
+}
+
+double ToDouble(const NumberValue& value) {
+    return std::visit(Overloaded{[](int64_t fixnum) { return static_cast<double>(fixnum); },
+                                 [](const BigInteger& bignum) { return bignum.ToDouble(); },
+                                 [](double flonum) { return flonum; }},
+                      value);
+}
+
+NumberValue AddNumbers(const NumberValue& lhs, const NumberValue& rhs) {
+    return Apply(kAddKernel, lhs, rhs);
+}
+
+NumberValue SubtractNumbers(const NumberValue& lhs, const NumberValue& rhs) {
+    return Apply(kSubtractKernel, lhs, rhs);
+}
+
+NumberValue MultiplyNumbers(const NumberValue& lhs, const NumberValue& rhs) {
+    return Apply(kMultiplyKernel, lhs, rhs);
+}
+
+NumberValue DivideNumbers(const NumberValue& lhs, const NumberValue& rhs) {
+    ThrowRuntimeErrorIf(IsExact(lhs) && IsExact(rhs) && IsZero(rhs), "/: division by zero");
+    return Apply(kDivideKernel, lhs, rhs);
+}
+
+NumberValue AbsNumber(const NumberValue& value) {
+    if (auto flonum = std::get_if<double>(&value)) {
+        return std::fabs(*flonum);
+    }
+    if (CompareNumbers(value, int64_t{0}) >= 0) {
+        return value;
+    }
+    return SubtractNumbers(int64_t{0}, value);
+}
+
+std::partial_ordering CompareNumbers(const NumberValue& lhs, const NumberValue& rhs) {
+    auto a = std::get_if<int64_t>(&lhs);
+    auto b = std::get_if<int64_t>(&rhs);
+    if (a && b) {
+        return *a <=> *b;
+    }
+    auto lhs_flonum = std::get_if<double>(&lhs);
+    auto rhs_flonum = std::get_if<double>(&rhs);
+    if (lhs_flonum && rhs_flonum) {
+        return *lhs_flonum <=> *rhs_flonum;
+    }
+    if (rhs_flonum) {
+        return CompareWithDouble(lhs, *rhs_flonum);
+    }
+    if (lhs_flonum) {
+        return 0 <=> CompareWithDouble(rhs, *lhs_flonum);
+    }
+    return ToBigInteger(lhs) <=> ToBigInteger(rhs);
+}
+
+bool IsZero(const NumberValue& value) {
+    return CompareNumbers(value, int64_t{0}) == 0;
+}
+
+size_t HashNumber(const NumberValue& value) {
+    return std::visit(Overloaded{[](int64_t value) { return std::hash<int64_t>{}(value); },
+                                 [](const BigInteger& value) { return value.Hash(); },
+                                 [](double value) {
+                                     // 0.0 and -0.0 compare equal, all NaNs hash alike.
+                                     if (value == 0 || std::isnan(value)) {
+                                         return size_t{0};
+                                     }
+                                     return std::hash<double>{}(value);
+                                 }},
+                      value);
+}
@@ -1,26 +1,39 @@
 #include <object.hpp>
 #include <garbage_collection.hpp>
+#include <func.hpp>
+#include <algorithm>
+#include <cmath>
+#include <utility>
 
 void Object::Mark() {
-    if (marked_) {
-        return;
-    }
-    marked_ = true;
-    for (auto dependency : dependencies_) {
-        dependency->Mark();
-    }
+    SetMarkedReachable(true);
 }
 
 void Object::Unmark() {
-    if (!marked_) {
-        return;
-    }
-    marked_ = false;
-    for (auto dependency : dependencies_) {
-        dependency->Unmark();
+    SetMarkedReachable(false);
+}
+
+void Object::SetMarkedReachable(bool marked) {
+    std::vector<Object*> stack{this};
+    while (!stack.empty()) {
+        auto obj = stack.back();
+        stack.pop_back();
+        if (!obj || obj->marked_ == marked) {
+            continue;
+        }
+        obj->marked_ = marked;
+        for (auto dependency : obj->dependencies_) {
+            if (dependency->marked_ != marked) {
+                stack.push_back(dependency);
+            }
+        }
+        obj->PushReferences(&stack);
     }
 }
 
+void Object::PushReferences(std::vector<Object*>*) const {
+}
+
 void Object::AddDependency(Object* dependency) {
     if (dependency) {
         dependencies_.insert(dependency);
@@ -29,24 +42,131 @@ void Object::AddDependency(Object* dependency) {
 
 void Object::RemoveDependency(Object* dependency) {
     if (dependency) {
-        dependencies_.erase(dependency);
+        if (auto it = dependencies_.find(dependency); it != dependencies_.end()) {
+            dependencies_.erase(it);
+        }
     }
 }
 
-Number::Number(int32_t value) : value_(value) {
+Number::Number(NumberValue value) : value_(std::move(value)) {
 }
 
-int32_t Number::GetValue() const {
+const NumberValue& Number::GetValue() const {
     return value_;
 }
 
-Symbol::Symbol(std::string symbol) : symbol_(std::move(symbol)) {
+Symbol::Symbol(std::string symbol, size_t position)
+    : symbol_(std::move(symbol)), position_(position) {
 }
 
 const std::string& Symbol::GetName() const {
     return symbol_;
 }
 
+size_t Symbol::GetPosition() const {
+    return position_;
+}
+
+void Symbol::MarkGlobal() {
+    global_ = true;
+}
+
+bool Symbol::IsGlobal() const {
+    return global_;
+}
+
+Function* Symbol::GetCachedFunction(uint64_t version) const {
+    return cached_version_ == version ? cached_function_ : nullptr;
+}
+
+void Symbol::SetCachedFunction(Function* function, uint64_t version) {
+    cached_function_ = function;
+    cached_version_ = version;
+}
+
+String::String(std::string value) : value_(std::move(value)), length_(value_.size()) {
+}
+
+String::String(String* left, String* right)
+    : left_(left), right_(right), length_(left->Length() + right->Length()) {
+}
+
+size_t String::Length() const {
+    return length_;
+}
+
+const std::string& String::GetValue() {
+    if (left_) {
+        Flatten();
+    }
+    return value_;
+}
+
+void String::PushReferences(std::vector<Object*>* stack) const {
+    stack->push_back(left_);
+    stack->push_back(right_);
+}
+
+// Ropes built by appending in a loop are as deep as they are long, so the
+// leaves are collected with an explicit stack.
+void String::Flatten() {
+    value_.reserve(length_);
+    std::vector<String*> stack{right_, left_};
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (node->left_) {
+            stack.push_back(node->right_);
+            stack.push_back(node->left_);
+        } else {
+            value_ += node->value_;
+        }
+    }
+    left_ = nullptr;
+    right_ = nullptr;
+}
+
+const std::shared_ptr<const LambdaInfo>& Symbol::GetLambdaInfo() const {
+    return lambda_info_;
+}
+
+void Symbol::SetLambdaInfo(std::shared_ptr<const LambdaInfo> info) {
+    lambda_info_ = std::move(info);
+}
+
+Object* Symbol::GetExpansion(const Function* macro) const {
+    return expansion_macro_ == macro ? expansion_ : nullptr;
+}
+
+// Both are kept alive, so that a new macro cannot reuse the address.
+void Symbol::SetExpansion(Function* macro, Object* expansion) {
+    RemoveDependency(expansion_macro_);
+    RemoveDependency(expansion_);
+    expansion_macro_ = macro;
+    expansion_ = expansion;
+    AddDependency(expansion_macro_);
+    AddDependency(expansion_);
+}
+
+Box::Box(Object* value) : value_(value), bound_(true) {
+    AddDependency(value_);
+}
+
+bool Box::IsBound() const {
+    return bound_;
+}
+
+Object* Box::Get() const {
+    return value_;
+}
+
+void Box::Set(Object* value) {
+    RemoveDependency(value_);
+    value_ = value;
+    bound_ = true;
+    AddDependency(value_);
+}
+
 Cell::Cell(Object* first, Object* second) : first_(first), second_(second) {
     AddDependency(first_);
     AddDependency(second_);
@@ -60,31 +180,389 @@ Object* Cell::GetSecond() const {
     return second_;
 }
 
-std::string Serialize(Object* obj) {
+void Cell::SetFirst(Object* first) {
+    RemoveDependency(first_);
+    first_ = first;
+    AddDependency(first_);
+}
+
+void Cell::SetSecond(Object* second) {
+    RemoveDependency(second_);
+    second_ = second;
+    AddDependency(second_);
+}
+
+Vector::Vector(std::vector<Object*> elements) : elements_(std::move(elements)) {
+}
+
+size_t Vector::Size() const {
+    return elements_.size();
+}
+
+Object* Vector::Get(size_t ind) const {
+    return elements_[ind];
+}
+
+void Vector::Set(size_t ind, Object* element) {
+    elements_[ind] = element;
+}
+
+void Vector::Fill(Object* element) {
+    std::fill(elements_.begin(), elements_.end(), element);
+}
+
+void Vector::PushReferences(std::vector<Object*>* stack) const {
+    stack->insert(stack->end(), elements_.begin(), elements_.end());
+}
+
+namespace {
+constexpr uint8_t kEmpty = 0;
+constexpr uint8_t kDeleted = 1;
+constexpr uint8_t kFull = 0x80;
+
+constexpr size_t kMinCapacity = 8;
+// Old slots moved into the new table by every update while growing.
+constexpr size_t kMigrationStep = 16;
+
+// Pointers and small integers have poor low bits, mix them before masking.
+size_t Mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+size_t HashKey(Object* key) {
+    if (Is<Number>(key)) {
+        return Mix(HashNumber(As<Number>(key)->GetValue()));
+    }
+    if (Is<Symbol>(key)) {
+        return Mix(std::hash<std::string>{}(As<Symbol>(key)->GetName()));
+    }
+    if (Is<String>(key)) {
+        return Mix(std::hash<std::string>{}(As<String>(key)->GetValue()));
+    }
+    return Mix(reinterpret_cast<uintptr_t>(key));
+}
+
+bool KeysEqual(Object* lhs, Object* rhs) {
+    if (lhs == rhs) {
+        return true;
+    }
+    if (Is<Number>(lhs) && Is<Number>(rhs)) {
+        const auto& a = As<Number>(lhs)->GetValue();
+        const auto& b = As<Number>(rhs)->GetValue();
+        if (a.index() != b.index()) {
+            return false;
+        }
+        if (auto flonum = std::get_if<double>(&a)) {
+            // Unlike =, a NaN key finds itself.
+            auto other = std::get<double>(b);
+            return *flonum == other || (std::isnan(*flonum) && std::isnan(other));
+        }
+        return CompareNumbers(a, b) == 0;
+    }
+    if (Is<Symbol>(lhs) && Is<Symbol>(rhs)) {
+        return As<Symbol>(lhs)->GetName() == As<Symbol>(rhs)->GetName();
+    }
+    if (Is<String>(lhs) && Is<String>(rhs)) {
+        return As<String>(lhs)->GetValue() == As<String>(rhs)->GetValue();
+    }
+    return false;
+}
+
+uint8_t ToControl(size_t hash) {
+    return kFull | static_cast<uint8_t>(hash >> 57);
+}
+}  // namespace
+
+HashTable::Table::Table(size_t capacity) : control(capacity, kEmpty), slots(2 * capacity) {
+}
+
+size_t HashTable::Table::Capacity() const {
+    return control.size();
+}
+
+size_t HashTable::Table::Find(Object* key, size_t hash) const {
+    auto mask = Capacity() - 1;
+    auto tag = ToControl(hash);
+    for (size_t i = hash & mask, probes = 0; probes < Capacity(); i = (i + 1) & mask, ++probes) {
+        if (control[i] == kEmpty) {
+            break;
+        }
+        if (control[i] == tag && KeysEqual(slots[2 * i], key)) {
+            return i;
+        }
+    }
+    return Capacity();
+}
+
+void HashTable::Table::Insert(Object* key, Object* value, size_t hash) {
+    auto mask = Capacity() - 1;
+    auto i = hash & mask;
+    while (control[i] & kFull) {
+        i = (i + 1) & mask;
+    }
+    if (control[i] == kEmpty) {
+        ++used;
+    }
+    control[i] = ToControl(hash);
+    slots[2 * i] = key;
+    slots[2 * i + 1] = value;
+}
+
+void HashTable::Table::Erase(size_t ind) {
+    control[ind] = kDeleted;
+    slots[2 * ind] = nullptr;
+    slots[2 * ind + 1] = nullptr;
+}
+
+Bytevector::Bytevector(std::vector<uint8_t> bytes) : bytes_(std::move(bytes)) {
+}
+
+size_t Bytevector::Size() const {
+    return bytes_.size();
+}
+
+uint8_t* Bytevector::Data() {
+    return bytes_.data();
+}
+
+size_t HashTable::Count() const {
+    return count_;
+}
+
+Object* const* HashTable::Find(Object* key) const {
+    if (count_ == 0) {
+        return nullptr;
+    }
+    auto hash = HashKey(key);
+    for (auto table : {&table_, &old_}) {
+        if (table->Capacity() == 0) {
+            continue;
+        }
+        if (auto ind = table->Find(key, hash); ind != table->Capacity()) {
+            return &table->slots[2 * ind + 1];
+        }
+    }
+    return nullptr;
+}
+
+void HashTable::Set(Object* key, Object* value) {
+    Migrate(kMigrationStep);
+    auto hash = HashKey(key);
+    for (auto table : {&table_, &old_}) {
+        if (table->Capacity() == 0) {
+            continue;
+        }
+        if (auto ind = table->Find(key, hash); ind != table->Capacity()) {
+            table->slots[2 * ind + 1] = value;
+            return;
+        }
+    }
+
+    if (4 * (table_.used + 1) > 3 * table_.Capacity()) {
+        Grow();
+    }
+    table_.Insert(key, value, hash);
+    ++count_;
+}
+
+bool HashTable::Delete(Object* key) {
+    Migrate(kMigrationStep);
+    auto hash = HashKey(key);
+    for (auto table : {&table_, &old_}) {
+        if (table->Capacity() == 0) {
+            continue;
+        }
+        if (auto ind = table->Find(key, hash); ind != table->Capacity()) {
+            table->Erase(ind);
+            --count_;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::pair<Object*, Object*>> HashTable::GetEntries() const {
+    std::vector<std::pair<Object*, Object*>> entries;
+    entries.reserve(count_);
+    for (auto table : {&table_, &old_}) {
+        for (size_t i = 0; i < table->Capacity(); ++i) {
+            if (table->control[i] & kFull) {
+                entries.emplace_back(table->slots[2 * i], table->slots[2 * i + 1]);
+            }
+        }
+    }
+    return entries;
+}
+
+void HashTable::PushReferences(std::vector<Object*>* stack) const {
+    for (auto table : {&table_, &old_}) {
+        stack->insert(stack->end(), table->slots.begin(), table->slots.end());
+    }
+}
+
+// The new table is large enough to take all the old entries before it fills
+// up again, so a growth normally never waits for the previous one.
+void HashTable::Grow() {
+    Migrate(old_.Capacity());
+    auto capacity = std::max(table_.Capacity(), kMinCapacity);
+    // Tables clogged with deleted slots are rebuilt at the same size.
+    if (2 * (count_ + 1) > capacity) {
+        capacity *= 2;
+    }
+    old_ = std::exchange(table_, Table(capacity));
+    migrated_ = 0;
+}
+
+void HashTable::Migrate(size_t slots_count) {
+    if (old_.Capacity() == 0) {
+        return;
+    }
+    for (auto end = std::min(migrated_ + slots_count, old_.Capacity()); migrated_ < end;
+         ++migrated_) {
+        if (old_.control[migrated_] & kFull) {
+            auto key = old_.slots[2 * migrated_];
+            table_.Insert(key, old_.slots[2 * migrated_ + 1], HashKey(key));
+            // Keep the slot deleted rather than empty for probes that pass it.
+            old_.Erase(migrated_);
+        }
+    }
+    if (migrated_ == old_.Capacity()) {
+        old_ = Table();
+    }
+}
+
+Promise::Promise(Object* value)
+    : state_(std::make_shared<State>(State{true, false, value, nullptr})) {
+}
+
+Promise::Promise(Object* thunk, bool is_lazy)
+    : state_(std::make_shared<State>(State{false, is_lazy, nullptr, thunk})) {
+}
+
+bool Promise::IsForced() const {
+    return state_->forced;
+}
+
+bool Promise::IsLazy() const {
+    return state_->is_lazy;
+}
+
+Object* Promise::GetValue() const {
+    return state_->value;
+}
+
+Object* Promise::GetThunk() const {
+    return state_->thunk;
+}
+
+void Promise::SetValue(Object* value) {
+    *state_ = State{true, false, value, nullptr};
+}
+
+void Promise::Adopt(Promise* other) {
+    *state_ = *other->state_;
+    other->state_ = state_;
+}
+
+void Promise::PushReferences(std::vector<Object*>* stack) const {
+    stack->push_back(state_->value);
+    stack->push_back(state_->thunk);
+}
+
+namespace {
+// Appends to a single buffer and recurses only into list elements, so long
+// lists are printed in linear time and constant stack depth.
+void SerializeTo(Object* obj, std::string* out) {
     if (obj == nullptr) {
-        return "()";
+        *out += "()";
+        return;
     }
     if (Is<Number>(obj)) {
-        return std::to_string(As<Number>(obj)->GetValue());
+        *out += NumberToString(As<Number>(obj)->GetValue());
+        return;
     }
     if (Is<Symbol>(obj)) {
-        return As<Symbol>(obj)->GetName();
+        *out += As<Symbol>(obj)->GetName();
+        return;
+    }
+    if (As<Function>(obj)) {
+        *out += "#<procedure>";
+        return;
+    }
+    if (Is<String>(obj)) {
+        *out += '"';
+        for (auto c : As<String>(obj)->GetValue()) {
+            if (c == '"' || c == '\\') {
+                *out += '\\';
+                *out += c;
+            } else if (c == '\n') {
+                *out += "\\n";
+            } else if (c == '\t') {
+                *out += "\\t";
+            } else {
+                *out += c;
+            }
+        }
+        *out += '"';
+        return;
+    }
+    if (Is<Bytevector>(obj)) {
+        auto bytevector = As<Bytevector>(obj);
+        *out += "#u8(";
+        for (size_t i = 0, size = bytevector->Size(); i < size; ++i) {
+            if (i != 0) {
+                *out += ' ';
+            }
+            *out += std::to_string(bytevector->Data()[i]);
+        }
+        *out += ')';
+        return;
+    }
+    if (Is<HashTable>(obj)) {
+        *out += "#<hash-table>";
+        return;
+    }
+    if (Is<Promise>(obj)) {
+        *out += "#<promise>";
+        return;
+    }
+    if (Is<Vector>(obj)) {
+        auto vector = As<Vector>(obj);
+        *out += "#(";
+        for (size_t i = 0, size = vector->Size(); i < size; ++i) {
+            if (i != 0) {
+                *out += ' ';
+            }
+            SerializeTo(vector->Get(i), out);
+        }
+        *out += ')';
+        return;
     }
 
-    auto first = As<Cell>(obj)->GetFirst();
-    auto second = As<Cell>(obj)->GetSecond();
-    auto s1 = Serialize(first);
-    auto s2 = Serialize(second);
-
-    if (second != nullptr && !Is<Cell>(second)) {
-        return "(" + std::move(s1) + " . " + std::move(s2) + ")";
+    *out += '(';
+    while (true) {
+        SerializeTo(As<Cell>(obj)->GetFirst(), out);
+        obj = As<Cell>(obj)->GetSecond();
+        if (!Is<Cell>(obj)) {
+            break;
+        }
+        *out += ' ';
     }
-    if (second == nullptr) {
-        return "(" + std::move(s1) + ")";
+    if (obj != nullptr) {
+        *out += " . ";
+        SerializeTo(obj, out);
     }
-    s2.pop_back();
-    s2.erase(0, 1);
-    return "(" + std::move(s1) + " " + std::move(s2) + ")";
+    *out += ')';
+}
+}  // namespace
+
+std::string Serialize(Object* obj) {
+    std::string result;
+    SerializeTo(obj, &result);
+    return result;
 }
 
 std::vector<Object*> ObjectToVector(Object* obj) {
@@ -0,0 +1,352 @@
+#include <optimizer.hpp>
+#include <error.hpp>
+#include <func.hpp>
+#include <macro.hpp>
+#include <garbage_collection.hpp>
+#include <unordered_map>
+
+namespace {
+using Names = std::unordered_set<std::string>;
+using Constants = std::unordered_map<std::string, Object*>;
+
+struct Context {
+    Scope* global_scope;
+    // Names bound by an enclosing lambda: its parameters and internal defines.
+    Names bound;
+    // Literal values of body defines that can be substituted for their names.
+    Constants constants;
+};
+
+// Form-wide facts collected before the rewrite.
+struct FormInfo {
+    // Targets of define or set! anywhere in the form.
+    Names rebound;
+    Names assigned;
+    std::unordered_map<std::string, size_t> define_count;
+    // Define targets that may bind a name outside of the global scope.
+    Names local_defines;
+};
+
+bool IsNamed(Object* obj, std::string_view name) {
+    return Is<Symbol>(obj) && As<Symbol>(obj)->GetName() == name;
+}
+
+Object* First(Object* obj) {
+    return Is<Cell>(obj) ? As<Cell>(obj)->GetFirst() : nullptr;
+}
+
+void CollectFormInfo(Object* obj, FormInfo* info, bool is_root) {
+    if (!Is<Cell>(obj)) {
+        return;
+    }
+    auto vector = ObjectToVector(obj);
+    if (vector.size() > 2) {
+        auto target = vector[1];
+        if (IsNamed(vector[0], "define") && Is<Cell>(target)) {
+            target = First(target);
+        }
+        if (Is<Symbol>(target)) {
+            const auto& name = As<Symbol>(target)->GetName();
+            if (IsNamed(vector[0], "define")) {
+                info->rebound.insert(name);
+                ++info->define_count[name];
+                if (!is_root) {
+                    info->local_defines.insert(name);
+                }
+            } else if (IsNamed(vector[0], "set!")) {
+                info->rebound.insert(name);
+                info->assigned.insert(name);
+            }
+        }
+    }
+    for (auto item : vector) {
+        CollectFormInfo(item, info, false);
+    }
+}
+
+class Optimizer {
+public:
+    Optimizer(Object* form, Scope* global_scope) : context_{global_scope, {}, {}} {
+        CollectFormInfo(form, &info_, true);
+    }
+
+    Object* Run(Object* obj) {
+        return Optimize(obj, context_);
+    }
+
+private:
+    // Returns the builtin the head symbol refers to, if it cannot have been
+    // shadowed or rebound by the form.
+    Function* ResolveBuiltin(Object* head, const Context& context) const {
+        if (!Is<Symbol>(head)) {
+            return nullptr;
+        }
+        const auto& name = As<Symbol>(head)->GetName();
+        if (context.bound.contains(name) || info_.rebound.contains(name)) {
+            return nullptr;
+        }
+        try {
+            return As<Function>(context.global_scope->GetObject(name));
+        } catch (const NameError&) {
+            return nullptr;
+        }
+    }
+
+    bool IsLiteral(Object* obj, const Context& context) const {
+        if (Is<Number>(obj)) {
+            return true;
+        }
+        if (IsNamed(obj, "#t") || IsNamed(obj, "#f")) {
+            const auto& name = As<Symbol>(obj)->GetName();
+            return !context.bound.contains(name) && !info_.rebound.contains(name);
+        }
+        return false;
+    }
+
+    bool IsPropagatable(const std::string& name) const {
+        auto it = info_.define_count.find(name);
+        return !info_.assigned.contains(name) && it != info_.define_count.end() &&
+               it->second == 1;
+    }
+
+    Object* Optimize(Object* obj, const Context& context) {
+        if (Is<Symbol>(obj)) {
+            if (auto it = context.constants.find(As<Symbol>(obj)->GetName());
+                it != context.constants.end()) {
+                return it->second;
+            }
+            return obj;
+        }
+        if (!Is<Cell>(obj)) {
+            return obj;
+        }
+
+        auto vector = ObjectToVector(obj);
+        if (vector.back() != nullptr) {
+            return obj;
+        }
+        auto head = vector[0];
+        auto func = ResolveBuiltin(head, context);
+        if (Is<Symbol>(head)) {
+            MarkIfGlobal(As<Symbol>(head), context);
+        }
+
+        // Templates of syntax-rules are not code until they are expanded.
+        if (Is<Quote>(func) || Is<CreateSyntaxRules>(func)) {
+            return obj;
+        }
+        if (Is<CreateLambda>(func)) {
+            return OptimizeLambda(std::move(vector), 1, context);
+        }
+        if (Is<Define>(func)) {
+            return OptimizeDefine(std::move(vector), context);
+        }
+        if (Is<Let>(func) || Is<LetStar>(func) || Is<Letrec>(func) || Is<Do>(func)) {
+            return OptimizeBindings(std::move(vector), Is<Do>(func), context);
+        }
+        if (Is<Set>(func)) {
+            if (vector.size() == 4) {
+                vector[2] = Optimize(vector[2], context);
+            }
+            return VectorToObject(vector);
+        }
+
+        for (size_t i = Is<Symbol>(head) ? 1 : 0; i + 1 < vector.size(); ++i) {
+            vector[i] = Optimize(vector[i], context);
+        }
+
+        if (Is<If>(func)) {
+            return OptimizeIf(std::move(vector), context);
+        }
+        if (func && func->IsPure()) {
+            return Fold(func, std::move(vector), context);
+        }
+        return VectorToObject(vector);
+    }
+
+    // Frames between a call site and the global scope belong to the lambdas
+    // enclosing it, so a name none of them can bind always resolves globally.
+    void MarkIfGlobal(Symbol* head, const Context& context) const {
+        const auto& name = head->GetName();
+        if (!context.bound.contains(name) && !info_.local_defines.contains(name)) {
+            head->MarkGlobal();
+        }
+    }
+
+    // Optimizes the parameter list and body of a lambda, which starts at
+    // vector[params_ind]. The define sugar keeps the name before parameters.
+    Object* OptimizeLambda(std::vector<Object*> vector, size_t params_ind,
+                           const Context& context, bool is_named = false) {
+        if (vector.size() < params_ind + 3) {
+            return VectorToObject(vector);
+        }
+        auto inner = context;
+        auto params = vector[params_ind];
+        if (is_named) {
+            params = As<Cell>(params)->GetSecond();
+        }
+        for (auto param : ObjectToVector(params)) {
+            if (Is<Symbol>(param)) {
+                inner.bound.insert(As<Symbol>(param)->GetName());
+                inner.constants.erase(As<Symbol>(param)->GetName());
+            }
+        }
+        for (size_t i = params_ind + 1; i + 1 < vector.size(); ++i) {
+            CollectBodyDefines(vector[i], &inner);
+        }
+        for (size_t i = params_ind + 1; i + 1 < vector.size(); ++i) {
+            vector[i] = Optimize(vector[i], inner);
+            RememberConstant(vector[i], &inner);
+        }
+        return VectorToObject(vector);
+    }
+
+    // Optimizes a binding form as if all of its names were bound everywhere
+    // in it, which is conservative for the initial values.
+    Object* OptimizeBindings(std::vector<Object*> vector, bool is_do, const Context& context) {
+        if (vector.size() < 4) {
+            return VectorToObject(vector);
+        }
+        auto inner = context;
+        size_t bindings_ind = 1;
+        if (!is_do && Is<Symbol>(vector[1])) {
+            Bind(vector[1], &inner);
+            bindings_ind = 2;
+        }
+        auto bindings = ObjectToVector(vector[bindings_ind]);
+        for (auto binding : bindings) {
+            Bind(First(binding), &inner);
+        }
+        for (size_t i = bindings_ind + 1; i + 1 < vector.size(); ++i) {
+            CollectBodyDefines(vector[i], &inner);
+        }
+
+        for (auto& binding : bindings) {
+            if (Is<Cell>(binding)) {
+                binding = OptimizeItems(ObjectToVector(binding), 1, inner);
+            }
+        }
+        vector[bindings_ind] = VectorToObject(bindings);
+        size_t body_ind = bindings_ind + 1;
+        if (is_do) {
+            // The test clause is a list of expressions, not a call.
+            vector[body_ind] = OptimizeItems(ObjectToVector(vector[body_ind]), 0, inner);
+            ++body_ind;
+        }
+        for (size_t i = body_ind; i + 1 < vector.size(); ++i) {
+            vector[i] = Optimize(vector[i], inner);
+            RememberConstant(vector[i], &inner);
+        }
+        return VectorToObject(vector);
+    }
+
+    // Optimizes the items of a proper list from vector[begin].
+    Object* OptimizeItems(std::vector<Object*> vector, size_t begin, const Context& context) {
+        if (vector.back() != nullptr) {
+            return VectorToObject(vector);
+        }
+        for (size_t i = begin; i + 1 < vector.size(); ++i) {
+            vector[i] = Optimize(vector[i], context);
+        }
+        return VectorToObject(vector);
+    }
+
+    void Bind(Object* name, Context* context) const {
+        if (Is<Symbol>(name)) {
+            context->bound.insert(As<Symbol>(name)->GetName());
+            context->constants.erase(As<Symbol>(name)->GetName());
+        }
+    }
+
+    // Internal defines bind names in the frame of the enclosing lambda.
+    void CollectBodyDefines(Object* obj, Context* context) const {
+        auto vector = ObjectToVector(obj);
+        if (vector.size() < 3 || !IsNamed(vector[0], "define")) {
+            return;
+        }
+        auto target = Is<Cell>(vector[1]) ? First(vector[1]) : vector[1];
+        if (Is<Symbol>(target)) {
+            context->bound.insert(As<Symbol>(target)->GetName());
+            context->constants.erase(As<Symbol>(target)->GetName());
+        }
+    }
+
+    void RememberConstant(Object* obj, Context* context) const {
+        auto vector = ObjectToVector(obj);
+        if (vector.size() != 4 || !Is<Symbol>(vector[1]) ||
+            !Is<Define>(ResolveBuiltin(vector[0], *context))) {
+            return;
+        }
+        const auto& name = As<Symbol>(vector[1])->GetName();
+        if (IsPropagatable(name) && IsLiteral(vector[2], *context)) {
+            context->constants[name] = vector[2];
+        }
+    }
+
+    Object* OptimizeDefine(std::vector<Object*> vector, const Context& context) {
+        if (vector.size() > 2 && Is<Cell>(vector[1])) {
+            return OptimizeLambda(std::move(vector), 1, context, true);
+        }
+        if (vector.size() == 4) {
+            vector[2] = Optimize(vector[2], context);
+        }
+        return VectorToObject(vector);
+    }
+
+    Object* OptimizeIf(std::vector<Object*> vector, const Context& context) {
+        if ((vector.size() != 4 && vector.size() != 5) || !IsConstant(vector[1], context)) {
+            return VectorToObject(vector);
+        }
+        auto branch = IsNamed(vector[1], "#f") ? 3 : 2;
+        if (branch + 1 == static_cast<int>(vector.size())) {
+            return VectorToObject(vector);
+        }
+        return vector[branch];
+    }
+
+    bool IsConstant(Object* obj, const Context& context) const {
+        if (IsLiteral(obj, context)) {
+            return true;
+        }
+        auto vector = ObjectToVector(obj);
+        return vector.size() == 3 && vector.back() == nullptr &&
+               Is<Quote>(ResolveBuiltin(vector[0], context)) && !IsNamed(vector[1], "#f");
+    }
+
+    Object* Fold(Function* func, std::vector<Object*> vector, const Context& context) {
+        if (vector.back() != nullptr) {
+            return VectorToObject(vector);
+        }
+        for (size_t i = 1; i + 1 < vector.size(); ++i) {
+            if (!IsLiteral(vector[i], context)) {
+                return VectorToObject(vector);
+            }
+        }
+
+        auto args = std::vector(vector.begin() + 1, vector.end() - 1);
+        Object* result{};
+        try {
+            result = func->Execute(FunctionArgs(args), context.global_scope);
+        } catch (const RuntimeError&) {
+            // Leave the error to be reported at run time.
+            return VectorToObject(vector);
+        }
+
+        if (Is<Number>(result)) {
+            return result;
+        }
+        if (IsNamed(result, "#t") || IsNamed(result, "#f")) {
+            return Heap::Instance().Make<Symbol>(As<Symbol>(result)->GetName());
+        }
+        return VectorToObject(vector);
+    }
+
+private:
+    Context context_;
+    FormInfo info_;
+};
+}  // namespace
+
+Object* Optimize(Object* obj, Scope* global_scope) {
+    return Optimizer(obj, global_scope).Run(obj);
+}
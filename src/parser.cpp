@@ -8,16 +8,24 @@ Object* Read(Tokenizer* tokenizer) {
         throw SyntaxError("Unexpected end of input stream");
     }
     Token token = tokenizer->GetToken();
+    auto position = tokenizer->GetPosition();
     tokenizer->Next();
 
     auto visitor = Overloaded{
         [](const ConstantToken& token) -> Object* {
             return Heap::Instance().Make<Number>(token.value);
         },
-        [](const SymbolToken& token) -> Object* {
-            return Heap::Instance().Make<Symbol>(token.name);
+        [position](const SymbolToken& token) -> Object* {
+            return Heap::Instance().Make<Symbol>(token.name, position);
+        },
+        [](const StringToken& token) -> Object* {
+            return Heap::Instance().Make<String>(token.value);
         },
         [&tokenizer](const OpenBracketToken&) -> Object* { return ReadList(tokenizer); },
+        [&tokenizer](const VectorOpenBracketToken&) -> Object* { return ReadVector(tokenizer); },
+        [&tokenizer](const BytevectorOpenBracketToken&) -> Object* {
+            return ReadBytevector(tokenizer);
+        },
         [&tokenizer](const QuoteToken&) -> Object* {
             auto first = Heap::Instance().Make<Symbol>("quote");
             auto second = Read(tokenizer);
@@ -27,29 +35,70 @@ Object* Read(Tokenizer* tokenizer) {
     return std::visit(std::move(visitor), std::move(token));
 }
 
-Object* ReadList(Tokenizer* tokenizer) {
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("Unexpected end of input stream");
+Object* ReadVector(Tokenizer* tokenizer) {
+    std::vector<Object*> elements;
+    while (true) {
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError("Unexpected end of input stream");
+        }
+        if (std::holds_alternative<CloseBracketToken>(tokenizer->GetToken())) {
+            tokenizer->Next();
+            return Heap::Instance().Make<Vector>(std::move(elements));
+        }
+        elements.push_back(Read(tokenizer));
     }
+}
 
-    if (std::holds_alternative<CloseBracketToken>(tokenizer->GetToken())) {
+Object* ReadBytevector(Tokenizer* tokenizer) {
+    std::vector<uint8_t> bytes;
+    while (true) {
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError("Unexpected end of input stream");
+        }
+        auto token = tokenizer->GetToken();
         tokenizer->Next();
-        return nullptr;
+        if (std::holds_alternative<CloseBracketToken>(token)) {
+            return Heap::Instance().Make<Bytevector>(std::move(bytes));
+        }
+        auto constant = std::get_if<ConstantToken>(&token);
+        auto byte = constant ? std::get_if<int64_t>(&constant->value) : nullptr;
+        if (!byte || *byte < 0 || *byte > 255) {
+            throw SyntaxError("Expected a byte in bytevector literal");
+        }
+        bytes.push_back(static_cast<uint8_t>(*byte));
     }
+}
 
-    auto first = Read(tokenizer);
-    Object* second{};
-    if (std::holds_alternative<DotToken>(tokenizer->GetToken())) {
-        tokenizer->Next();
-        second = Read(tokenizer);
-        if (tokenizer->IsEnd() ||
-            !std::holds_alternative<CloseBracketToken>(tokenizer->GetToken())) {
-            throw SyntaxError("Expected ')'");
+// Elements are appended to the last cell instead of recursing per element,
+// so long literals do not overflow the call stack.
+Object* ReadList(Tokenizer* tokenizer) {
+    Object* head{};
+    Cell* last{};
+    while (true) {
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError("Unexpected end of input stream");
+        }
+        if (std::holds_alternative<CloseBracketToken>(tokenizer->GetToken())) {
+            tokenizer->Next();
+            return head;
+        }
+        if (last && std::holds_alternative<DotToken>(tokenizer->GetToken())) {
+            tokenizer->Next();
+            last->SetSecond(Read(tokenizer));
+            if (tokenizer->IsEnd() ||
+                !std::holds_alternative<CloseBracketToken>(tokenizer->GetToken())) {
+                throw SyntaxError("Expected ')'");
+            }
+            tokenizer->Next();
+            return head;
         }
-        tokenizer->Next();
 
-    } else {
-        second = ReadList(tokenizer);
+        auto cell = As<Cell>(Heap::Instance().Make<Cell>(Read(tokenizer), nullptr));
+        if (last) {
+            last->SetSecond(cell);
+        } else {
+            head = cell;
+        }
+        last = cell;
     }
-    return Heap::Instance().Make<Cell>(first, second);
 }
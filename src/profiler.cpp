@@ -0,0 +1,153 @@
+#include <profiler.hpp>
+#include <error.hpp>
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/time.h>
+#define SCHEME_PROFILER_SIGPROF
+#endif
+
+namespace {
+// Calls deeper than this are not recorded, samples keep the outermost frames.
+constexpr size_t kMaxDepth = 1 << 16;
+constexpr size_t kMaxSampleDepth = 512;
+// About 16MB of labels, samples that do not fit are counted as dropped.
+constexpr size_t kSamplesCapacity = 1 << 22;
+
+constexpr uint32_t kTruncatedLabel = 0;
+
+#ifdef SCHEME_PROFILER_SIGPROF
+struct sigaction previous_action;
+#endif
+}  // namespace
+
+Profiler Profiler::instance_;
+
+void Profiler::Start(std::chrono::microseconds interval) {
+#ifdef SCHEME_PROFILER_SIGPROF
+    ThrowRuntimeErrorIf(active_, "profile-start: profiler is already running");
+    ThrowRuntimeErrorIf(interval.count() <= 0, "profile-start: expected positive interval");
+
+    ++generation_;
+    labels_ = {"[truncated]"};
+    label_ids_.clear();
+    stack_.assign(kMaxDepth, 0);
+    depth_ = 0;
+    samples_.assign(kSamplesCapacity, 0);
+    samples_size_ = 0;
+    dropped_ = 0;
+
+    struct sigaction action {};
+    action.sa_handler = HandleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previous_action);
+
+    active_ = true;
+    itimerval timer{};
+    timer.it_interval.tv_sec = interval.count() / 1000000;
+    timer.it_interval.tv_usec = interval.count() % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#else
+    (void)interval;
+    throw RuntimeError("profile-start: sampling is not supported on this platform");
+#endif
+}
+
+void Profiler::Stop(const std::string& path) {
+    ThrowRuntimeErrorIf(!active_, "profile-stop: profiler is not running");
+    // Keeps sampling if the file cannot be created, so that it can be retried.
+    std::ofstream out(path);
+    ThrowRuntimeErrorIf(!out, "profile-stop: cannot open " + path);
+
+#ifdef SCHEME_PROFILER_SIGPROF
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &previous_action, nullptr);
+#endif
+    active_ = false;
+
+    std::map<std::string, size_t> stacks;
+    for (size_t ind = 0; ind < samples_size_;) {
+        size_t depth = samples_[ind++];
+        std::string stack = depth == 0 ? "[toplevel]" : "";
+        for (size_t frame = 0; frame < depth; ++frame) {
+            if (frame > 0) {
+                stack.push_back(';');
+            }
+            stack += labels_[samples_[ind++]];
+        }
+        ++stacks[stack];
+    }
+    samples_ = {};
+    stack_ = {};
+
+    for (const auto& [stack, count] : stacks) {
+        out << stack << ' ' << count << '\n';
+    }
+    if (dropped_ > 0) {
+        out << "[dropped] " << dropped_ << '\n';
+    }
+    ThrowRuntimeErrorIf(!out, "profile-stop: cannot write " + path);
+}
+
+uint32_t Profiler::Intern(std::string label) {
+    auto [it, inserted] = label_ids_.try_emplace(std::move(label), labels_.size());
+    if (inserted) {
+        labels_.push_back(it->first);
+    }
+    return it->second;
+}
+
+void Profiler::SaveFrames(size_t base, std::vector<uint32_t>* frames) {
+    auto depth = depth_.load(std::memory_order_relaxed);
+    frames->clear();
+    for (auto frame = base; frame < depth; ++frame) {
+        frames->push_back(frame < stack_.size() ? stack_[frame] : kTruncatedLabel);
+    }
+    depth_.store(std::min(base, depth), std::memory_order_relaxed);
+}
+
+void Profiler::RestoreFrames(const std::vector<uint32_t>& frames) {
+    for (auto label : frames) {
+        Enter(label);
+    }
+}
+
+void Profiler::HandleSignal(int) {
+    Instance().TakeSample();
+}
+
+// Runs in the signal handler, so it only copies into preallocated memory.
+void Profiler::TakeSample() {
+    if (!active_) {
+        return;
+    }
+    auto depth = depth_.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+
+    auto truncated = depth > kMaxSampleDepth || depth > kMaxDepth;
+    auto recorded = std::min({depth, kMaxSampleDepth, kMaxDepth});
+    auto size = 1 + recorded + (truncated ? 1 : 0);
+    if (samples_size_ + size > samples_.size()) {
+        ++dropped_;
+        return;
+    }
+
+    samples_[samples_size_++] = size - 1;
+    for (size_t frame = 0; frame < recorded; ++frame) {
+        samples_[samples_size_++] = stack_[frame];
+    }
+    if (truncated) {
+        samples_[samples_size_++] = kTruncatedLabel;
+    }
+}
+
+uint32_t ProfiledCall::Intern(const std::string& name, size_t position) {
+    return Profiler::Instance().Intern((name.empty() ? "lambda" : name) + "@" +
+                                       std::to_string(position));
+}
@@ -0,0 +1,102 @@
+#include <scheduler.hpp>
+#include <control.hpp>
+#include <error.hpp>
+#include <algorithm>
+
+Scheduler::Scheduler(size_t threads, uint64_t slice) : slice_(slice) {
+    ThrowRuntimeErrorIf(threads == 0 || slice == 0, "Scheduler: expected threads and a slice");
+    for (size_t ind = 0; ind < threads; ++ind) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t ind = 0; ind < threads; ++ind) {
+        workers_[ind]->thread = std::thread([this, ind] { Work(ind); });
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    for (auto& worker : workers_) {
+        worker->wakeup.notify_one();
+    }
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+std::future<std::string> Scheduler::Submit(Interpreter* interpreter, std::string query) {
+    std::lock_guard lock(mutex_);
+    auto& tenant = tenants_[interpreter];
+    if (!tenant) {
+        auto worker = std::min_element(workers_.begin(), workers_.end(),
+                                       [](const auto& lhs, const auto& rhs) {
+                                           return lhs->tenants < rhs->tenants;
+                                       });
+        tenant.reset(new Tenant{interpreter, static_cast<size_t>(worker - workers_.begin()), {},
+                                nullptr});
+        ++(*worker)->tenants;
+    }
+    auto& queued = tenant->queries.emplace_back(Query{std::move(query), {}});
+    auto result = queued.result.get_future();
+    // A tenant with more queries is queued again when its first one finishes.
+    if (tenant->queries.size() == 1) {
+        auto& worker = *workers_[tenant->worker];
+        worker.ready.push_back(tenant.get());
+        worker.wakeup.notify_one();
+    }
+    return result;
+}
+
+void Scheduler::Work(size_t ind) {
+    auto& worker = *workers_[ind];
+    std::unique_lock lock(mutex_);
+    while (true) {
+        worker.wakeup.wait(lock, [&] { return stopping_ || !worker.ready.empty(); });
+        if (stopping_) {
+            break;
+        }
+        auto tenant = worker.ready.front();
+        worker.ready.pop_front();
+        auto& query = tenant->queries.front();
+        if (!tenant->evaluation) {
+            tenant->evaluation = tenant->interpreter->Start(query.text);
+        }
+        lock.unlock();
+
+        bool done = true;
+        try {
+            done = tenant->evaluation->Resume(slice_);
+            if (done) {
+                query.result.set_value(tenant->evaluation->GetResult());
+            }
+        } catch (...) {
+            query.result.set_exception(std::current_exception());
+        }
+        if (done) {
+            tenant->evaluation.reset();
+        }
+
+        lock.lock();
+        if (!done) {
+            worker.ready.push_back(tenant);
+            continue;
+        }
+        tenant->queries.pop_front();
+        if (!tenant->queries.empty()) {
+            worker.ready.push_back(tenant);
+        } else {
+            --worker.tenants;
+            tenants_.erase(tenant->interpreter);
+        }
+    }
+
+    // Evaluations are unwound on the thread that ran them.
+    std::vector<std::unique_ptr<Evaluation>> cancelled;
+    for (auto tenant : worker.ready) {
+        cancelled.push_back(std::move(tenant->evaluation));
+    }
+    lock.unlock();
+    cancelled.clear();
+}
@@ -1,14 +1,84 @@
 #include <scheme.hpp>
 #include <sstream>
+#include <utility>
 #include <garbage_collection.hpp>
 #include <error.hpp>
 #include <parser.hpp>
 #include <func.hpp>
+#include <optimizer.hpp>
+#include <macro.hpp>
+#include <control.hpp>
+#include <stream.hpp>
+#include <instrumentation.hpp>
 
-Interpreter::Interpreter() : global_scope_(std::make_unique<Scope>()) {
+namespace {
+// Makes the heap of an interpreter the one of the thread until the end of
+// the scope.
+class HeapScope final {
+public:
+    explicit HeapScope(Heap* heap) : previous_(&Heap::Instance()) {
+        Heap::SetInstance(heap);
+    }
+
+    ~HeapScope() {
+        Heap::SetInstance(previous_);
+    }
+
+    HeapScope(const HeapScope&) = delete;
+    HeapScope& operator=(const HeapScope&) = delete;
+
+private:
+    Heap* previous_;
+};
+
+// Lets allocations collect the heap while the query is evaluated.
+class EvaluationScope final {
+public:
+    EvaluationScope(Heap* heap, Scope* root, Object* query) : heap_(heap) {
+        heap_->BeginEvaluation(root, query);
+    }
+
+    ~EvaluationScope() {
+        heap_->EndEvaluation();
+    }
+
+    EvaluationScope(const EvaluationScope&) = delete;
+    EvaluationScope& operator=(const EvaluationScope&) = delete;
+
+private:
+    Heap* heap_;
+};
+
+// Garbage that calls from the host leave before they collect the heap, on
+// top of as many objects as the last collection left.
+constexpr size_t kCallGarbage = 4096;
+
+class RunScope final {
+public:
+    RunScope(Heap* heap, bool* running) : heap_scope_(heap), running_(running) {
+        ThrowRuntimeErrorIf(*running_, "Interpreter is already running a query");
+        *running_ = true;
+    }
+
+    ~RunScope() {
+        *running_ = false;
+    }
+
+    RunScope(const RunScope&) = delete;
+    RunScope& operator=(const RunScope&) = delete;
+
+private:
+    HeapScope heap_scope_;
+    bool* running_;
+};
+}  // namespace
+
+Interpreter::Interpreter()
+    : heap_(std::make_unique<Heap>()), global_scope_(std::make_unique<Scope>()) {
+    HeapScope heap_scope(heap_.get());
     std::unordered_map<std::string, Object*> scope = {
-        {"#t", Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Symbol>("#t"))},
-        {"#f", Heap::Instance().Make<ObjectHolder>(Heap::Instance().Make<Symbol>("#f"))},
+        {"#t", Heap::Instance().Make<Symbol>("#t")},
+        {"#f", Heap::Instance().Make<Symbol>("#f")},
 
         {"boolean?", Heap::Instance().Make<IsBoolean>()},
         {"not", Heap::Instance().Make<Not>()},
@@ -40,6 +110,54 @@ Interpreter::Interpreter() : global_scope_(std::make_unique<Scope>()) {
         {"list", Heap::Instance().Make<List>()},
         {"list-ref", Heap::Instance().Make<ListRef>()},
         {"list-tail", Heap::Instance().Make<ListTail>()},
+        {"length", Heap::Instance().Make<Length>()},
+        {"append", Heap::Instance().Make<Append>()},
+        {"reverse", Heap::Instance().Make<Reverse>()},
+        {"map", Heap::Instance().Make<Map>()},
+        {"for-each", Heap::Instance().Make<ForEach>()},
+        {"filter", Heap::Instance().Make<Filter>()},
+        {"fold-left", Heap::Instance().Make<FoldLeft>()},
+        {"fold-right", Heap::Instance().Make<FoldRight>()},
+        {"assoc", Heap::Instance().Make<Assoc>()},
+        {"member", Heap::Instance().Make<Member>()},
+        {"apply", Heap::Instance().Make<Apply>()},
+
+        {"vector?", Heap::Instance().Make<IsVector>()},
+        {"make-vector", Heap::Instance().Make<MakeVector>()},
+        {"vector", Heap::Instance().Make<CreateVector>()},
+        {"vector-length", Heap::Instance().Make<VectorLength>()},
+        {"vector-ref", Heap::Instance().Make<VectorRef>()},
+        {"vector-set!", Heap::Instance().Make<VectorSet>()},
+        {"vector-fill!", Heap::Instance().Make<VectorFill>()},
+        {"bytevector?", Heap::Instance().Make<IsBytevector>()},
+        {"make-bytevector", Heap::Instance().Make<MakeBytevector>()},
+        {"bytevector", Heap::Instance().Make<CreateBytevector>()},
+        {"bytevector-length", Heap::Instance().Make<BytevectorLength>()},
+        {"bytevector-u8-ref", Heap::Instance().Make<BytevectorRef>()},
+        {"bytevector-u8-set!", Heap::Instance().Make<BytevectorSet>()},
+        {"bytevector-copy!", Heap::Instance().Make<BytevectorCopy>()},
+        {"bytevector-fill!", Heap::Instance().Make<BytevectorFill>()},
+        {"bytevector=?", Heap::Instance().Make<BytevectorEqual>()},
+        {"bytevector-compare", Heap::Instance().Make<BytevectorCompare>()},
+        {"bytevector-search", Heap::Instance().Make<BytevectorSearch>()},
+        {"hash-table?", Heap::Instance().Make<IsHashTable>()},
+        {"make-hash-table", Heap::Instance().Make<MakeHashTable>()},
+        {"hash-table-ref", Heap::Instance().Make<HashTableRef>()},
+        {"hash-table-set!", Heap::Instance().Make<HashTableSet>()},
+        {"hash-table-delete!", Heap::Instance().Make<HashTableDelete>()},
+        {"hash-table-count", Heap::Instance().Make<HashTableCount>()},
+        {"hash-table-walk", Heap::Instance().Make<HashTableWalk>()},
+        {"string?", Heap::Instance().Make<IsString>()},
+        {"string-length", Heap::Instance().Make<StringLength>()},
+        {"string-ref", Heap::Instance().Make<StringRef>()},
+        {"substring", Heap::Instance().Make<Substring>()},
+        {"string=?", Heap::Instance().Make<StringEqual>()},
+        {"string-append", Heap::Instance().Make<StringAppend>()},
+        {"string->symbol", Heap::Instance().Make<StringToSymbol>()},
+        {"number->string", Heap::Instance().Make<ConvertNumberToString>()},
+
+        {"profile-start", Heap::Instance().Make<ProfileStart>()},
+        {"profile-stop", Heap::Instance().Make<ProfileStop>()},
 
         {"symbol?", Heap::Instance().Make<IsSymbol>()},
         {"define", Heap::Instance().Make<Define>()},
@@ -49,25 +167,138 @@ Interpreter::Interpreter() : global_scope_(std::make_unique<Scope>()) {
 
         {"if", Heap::Instance().Make<If>()},
         {"lambda", Heap::Instance().Make<CreateLambda>()},
+        {"let", Heap::Instance().Make<Let>()},
+        {"let*", Heap::Instance().Make<LetStar>()},
+        {"letrec", Heap::Instance().Make<Letrec>()},
+        {"do", Heap::Instance().Make<Do>()},
+        {"define-syntax", Heap::Instance().Make<DefineSyntax>()},
+        {"syntax-rules", Heap::Instance().Make<CreateSyntaxRules>()},
+
+        {"call/cc", Heap::Instance().Make<CallWithCurrentContinuation>()},
+        {"call-with-current-continuation", Heap::Instance().Make<CallWithCurrentContinuation>()},
+        {"make-generator", Heap::Instance().Make<MakeGenerator>()},
+        {"generator-done?", Heap::Instance().Make<IsGeneratorDone>()},
+
+        {"delay", Heap::Instance().Make<Delay>()},
+        {"delay-force", Heap::Instance().Make<DelayForce>()},
+        {"make-promise", Heap::Instance().Make<MakePromise>()},
+        {"force", Heap::Instance().Make<Force>()},
+        {"promise?", Heap::Instance().Make<IsPromise>()},
+        {"cons-stream", Heap::Instance().Make<ConsStream>()},
+        {"stream-car", Heap::Instance().Make<StreamCar>()},
+        {"stream-cdr", Heap::Instance().Make<StreamCdr>()},
+        {"stream-map", Heap::Instance().Make<StreamMap>()},
+        {"stream-filter", Heap::Instance().Make<StreamFilter>()},
+        {"stream-take", Heap::Instance().Make<StreamTake>()},
+        {"stream->list", Heap::Instance().Make<StreamToList>()},
     };
 
     for (auto &&[name, func] : scope) {
-        global_scope_->PutFunction(std::move(name), As<Function>(func));
+        global_scope_->PutObject(std::move(name), func);
     }
 }
 
 std::string Interpreter::Run(const std::string &input) {
-    std::stringstream stream{input};
-    auto tokenizer = Tokenizer(&stream);
-    auto object = Read(&tokenizer);
-    ThrowSyntaxErrorIf(!tokenizer.IsEnd(), "Syntax error when parsing the query");
-
-    auto result = Process(object, global_scope_.get());
-    auto serialized_result = Serialize(result);
-    Heap::Instance().MarkAndSweep(global_scope_.get());
+    TraceSpan<> span("Interpreter::Run", "run");
+    RunScope run_scope(heap_.get(), &running_);
+    std::string serialized_result;
+    try {
+        std::stringstream stream{input};
+        auto tokenizer = Tokenizer(&stream);
+        auto object = Read(&tokenizer);
+        ThrowSyntaxErrorIf(!tokenizer.IsEnd(), "Syntax error when parsing the query");
+        object = ExpandMacros(object, global_scope_.get());
+        object = Optimize(object, global_scope_.get());
+
+        EvaluationScope evaluation_scope(heap_.get(), global_scope_.get(), object);
+        serialized_result = Serialize(Process(object, global_scope_.get()));
+    } catch (...) {
+        // The garbage of a failed query would count against the next one.
+        heap_->MarkAndSweep(global_scope_.get());
+        live_objects_ = heap_->GetSize();
+        throw;
+    }
+    heap_->MarkAndSweep(global_scope_.get());
+    live_objects_ = heap_->GetSize();
     return serialized_result;
 }
 
+std::unique_ptr<Evaluation> Interpreter::Start(std::string query) {
+    return std::make_unique<Evaluation>([this, query = std::move(query)] { return Run(query); });
+}
+
+void Interpreter::SetHeapLimit(size_t objects) {
+    heap_->SetLimit(objects);
+}
+
+size_t Interpreter::GetHeapSize() const {
+    return heap_->GetSize();
+}
+
+void Interpreter::BindGlobal(const std::string &name, const std::function<Object *()> &make) {
+    RunScope run_scope(heap_.get(), &running_);
+    global_scope_->PutObject(name, make());
+}
+
+ProcedureHandle Interpreter::GetProcedure(const std::string &name) {
+    auto proc = global_scope_->GetObject(name);
+    ThrowRuntimeErrorIf(!As<Procedure>(proc), name + ": expected a procedure");
+    return ProcedureHandle(this, proc, name);
+}
+
 Interpreter::~Interpreter() {
-    Heap::Instance().MarkAndSweep(nullptr);
+    HeapScope heap_scope(heap_.get());
+    heap_->MarkAndSweep(nullptr);
+}
+
+ProcedureHandle::ProcedureHandle(Interpreter *interpreter, Object *proc, std::string name)
+    : interpreter_(interpreter), proc_(proc), name_(std::move(name)) {
+    interpreter_->heap_->Retain(proc_);
+}
+
+ProcedureHandle::ProcedureHandle(ProcedureHandle &&other) noexcept
+    : interpreter_(other.interpreter_),
+      proc_(std::exchange(other.proc_, nullptr)),
+      name_(std::move(other.name_)) {
+}
+
+ProcedureHandle &ProcedureHandle::operator=(ProcedureHandle &&other) noexcept {
+    if (this != &other) {
+        if (proc_) {
+            interpreter_->heap_->Release(proc_);
+        }
+        interpreter_ = other.interpreter_;
+        proc_ = std::exchange(other.proc_, nullptr);
+        name_ = std::move(other.name_);
+    }
+    return *this;
+}
+
+ProcedureHandle::~ProcedureHandle() {
+    if (proc_) {
+        interpreter_->heap_->Release(proc_);
+    }
+}
+
+ProcedureHandle::CallScope::CallScope(Interpreter *interpreter)
+    : interpreter_(interpreter), previous_(&Heap::Instance()) {
+    ThrowRuntimeErrorIf(interpreter_->running_, "Interpreter is already running a query");
+    interpreter_->running_ = true;
+    Heap::SetInstance(interpreter_->heap_.get());
+    interpreter_->heap_->BeginEvaluation(interpreter_->global_scope_.get(), nullptr);
+}
+
+ProcedureHandle::CallScope::~CallScope() {
+    auto &heap = *interpreter_->heap_;
+    heap.EndEvaluation();
+    if (heap.GetSize() > 2 * interpreter_->live_objects_ + kCallGarbage) {
+        heap.MarkAndSweep(interpreter_->global_scope_.get());
+        interpreter_->live_objects_ = heap.GetSize();
+    }
+    Heap::SetInstance(previous_);
+    interpreter_->running_ = false;
+}
+
+Scope *ProcedureHandle::CallScope::GetGlobalScope() const {
+    return interpreter_->global_scope_.get();
 }
@@ -1,6 +1,102 @@
 #include <scope.hpp>
 #include <error.hpp>
-#include <func.hpp>
+#include <instrumentation.hpp>
+#include <algorithm>
+
+thread_local FrameStack FrameStack::main_;
+thread_local FrameStack* FrameStack::instance_ = &FrameStack::main_;
+
+FrameStack& FrameStack::Instance() {
+    return *instance_;
+}
+
+void FrameStack::SetInstance(FrameStack* frames) {
+    instance_ = frames;
+}
+
+size_t FrameStack::Size() const {
+    return slots_.size();
+}
+
+FrameStack::Slot& FrameStack::operator[](size_t ind) {
+    return slots_[ind];
+}
+
+void FrameStack::Push(const std::string* name, Object* obj) {
+    slots_.emplace_back(name, obj);
+}
+
+void FrameStack::Pop(size_t size) {
+    slots_.resize(size);
+}
+
+void FrameStack::Pin(const std::vector<Object*>* objects) {
+    pinned_.push_back(objects);
+}
+
+void FrameStack::Unpin() {
+    pinned_.pop_back();
+}
+
+Object** FrameStack::PushArguments(Object* form, size_t* count) {
+    *count = 0;
+    auto rest = form;
+    for (; Is<Cell>(rest); rest = As<Cell>(rest)->GetSecond()) {
+        ++*count;
+    }
+    ThrowSyntaxErrorIf(rest != nullptr, "Unexpected dotted call");
+
+    auto arguments = Reserve(*count);
+    for (auto argument = arguments; Is<Cell>(form); form = As<Cell>(form)->GetSecond()) {
+        *argument++ = As<Cell>(form)->GetFirst();
+    }
+    return arguments;
+}
+
+Object** FrameStack::Reserve(size_t count) {
+    if (chunks_.empty()) {
+        chunks_.push_back({nullptr, 0, 0});
+    }
+    if (chunks_[top_chunk_].size + count > chunks_[top_chunk_].capacity) {
+        // The rest of a used chunk stays unused until the chunk is the top
+        // one again.
+        if (chunks_[top_chunk_].size > 0 && ++top_chunk_ == chunks_.size()) {
+            chunks_.push_back({nullptr, 0, 0});
+        }
+        auto& chunk = chunks_[top_chunk_];
+        if (chunk.capacity < count) {
+            chunk.capacity = std::max(count, kArgumentsChunk);
+            chunk.values = std::make_unique<Object*[]>(chunk.capacity);
+        }
+    }
+    auto& chunk = chunks_[top_chunk_];
+    auto arguments = chunk.values.get() + chunk.size;
+    chunk.size += count;
+    return arguments;
+}
+
+void FrameStack::PopArguments(size_t count) {
+    auto& chunk = chunks_[top_chunk_];
+    chunk.size -= count;
+    if (chunk.size == 0 && top_chunk_ > 0) {
+        --top_chunk_;
+    }
+}
+
+void FrameStack::PushRoots(std::vector<Object*>* roots) const {
+    for (const auto& [name, obj] : slots_) {
+        roots->push_back(obj);
+    }
+    for (auto objects : pinned_) {
+        roots->insert(roots->end(), objects->begin(), objects->end());
+    }
+    for (size_t ind = 0; ind < chunks_.size() && ind <= top_chunk_; ++ind) {
+        const auto& chunk = chunks_[ind];
+        roots->insert(roots->end(), chunk.values.get(), chunk.values.get() + chunk.size);
+    }
+}
+
+std::atomic<uint64_t> Scope::global_version_ = 1;
 
 Scope::Scope(Scope* parent_scope) : parent_scope_(parent_scope) {
     if (parent_scope_) {
@@ -8,43 +104,143 @@ Scope::Scope(Scope* parent_scope) : parent_scope_(parent_scope) {
     }
 }
 
-void Scope::PutFunction(std::string name, Function* func) {
-    if (Is<ObjectHolder>(func)) {
-        As<ObjectHolder>(func)->SetName(name);
+Scope::Scope(Scope* parent_scope, FrameStack* frames)
+    : parent_scope_(parent_scope),
+      frames_(frames),
+      frame_begin_(frames->Size()),
+      frame_end_(frame_begin_) {
+}
+
+Scope::~Scope() {
+    if (frames_) {
+        frames_->Pop(frame_begin_);
     }
+}
 
-    if (auto it = scope_.find(name); it != scope_.end()) {
-        RemoveDependency(it->second);
+Object** Scope::Find(const std::string& name) const {
+    if (!frames_) {
+        auto it = scope_.find(name);
+        return it != scope_.end() ? const_cast<Object**>(&it->second) : nullptr;
+    }
+    for (auto ind = frame_begin_; ind < frame_end_; ++ind) {
+        auto& [slot_name, obj] = (*frames_)[ind];
+        if (*slot_name == name) {
+            return &obj;
+        }
     }
+    return nullptr;
+}
 
-    scope_[std::move(name)] = func;
-    AddDependency(func);
+void Scope::PutLocal(const std::string* name, Object* obj) {
+    if (auto slot = Find(*name)) {
+        *slot = obj;
+        return;
+    }
+    // Nested calls have returned by the time their caller binds a name.
+    ThrowRuntimeErrorIf(frame_end_ != frames_->Size(), "Invalid frame");
+    frames_->Push(name, obj);
+    ++frame_end_;
 }
 
-void Scope::SetFunction(const std::string& name, Function* func) {
-    if (auto it = scope_.find(name); it != scope_.end()) {
-        RemoveDependency(it->second);
-        it->second = func;
-        AddDependency(func);
+void Scope::PutObject(const std::string& name, Object* obj) {
+    auto slot = Find(name);
+    // Internal defines fill the box closures may have captured already.
+    if (slot && Is<Box>(*slot) && !Is<Box>(obj)) {
+        As<Box>(*slot)->Set(obj);
         return;
     }
-    if (parent_scope_) {
-        parent_scope_->SetFunction(name, func);
+    if (frames_) {
+        if (slot) {
+            *slot = obj;
+        } else {
+            PutLocal(&extra_names_.emplace_front(name), obj);
+        }
         return;
     }
-    throw NameError("Invalid name: " + name);
+
+    if (slot) {
+        RemoveDependency(*slot);
+        *slot = obj;
+    } else {
+        scope_.emplace(name, obj);
+    }
+    AddDependency(obj);
+    OnChange();
 }
 
-Function* Scope::GetFunction(const std::string& name) const {
-    if (auto it = scope_.find(name); it != scope_.end()) {
-        return it->second;
+void Scope::SetObject(const std::string& name, Object* obj) {
+    if (auto slot = Find(name)) {
+        if (Is<Box>(*slot)) {
+            As<Box>(*slot)->Set(obj);
+            return;
+        }
+        if (!frames_) {
+            RemoveDependency(*slot);
+            AddDependency(obj);
+        }
+        *slot = obj;
+        OnChange();
+        return;
     }
     if (parent_scope_) {
-        return parent_scope_->GetFunction(name);
+        parent_scope_->SetObject(name, obj);
+        return;
+    }
+    throw NameError("Invalid name: " + name);
+}
+
+Object* Scope::GetObject(const std::string& name) const {
+    size_t depth = 0;
+    for (auto scope = this; scope; scope = scope->parent_scope_, ++depth) {
+        auto slot = scope->Find(name);
+        if (!slot) {
+            continue;
+        }
+        // A box waits for an internal define, outer bindings stay visible
+        // until then.
+        if (Is<Box>(*slot) && !As<Box>(*slot)->IsBound()) {
+            continue;
+        }
+        if constexpr (kInstrumentationEnabled) {
+            Instrumentation::Instance().CountLookup(depth);
+        }
+        return Is<Box>(*slot) ? As<Box>(*slot)->Get() : *slot;
     }
     throw NameError("Invalid name: " + name);
 }
 
+bool Scope::FindLocal(const std::string& name, Object** obj) const {
+    for (auto scope = this; !scope->IsGlobal(); scope = scope->parent_scope_) {
+        if (auto slot = scope->Find(name)) {
+            *obj = *slot;
+            return true;
+        }
+    }
+    return false;
+}
+
+Scope* Scope::GetGlobalScope() {
+    auto scope = this;
+    while (!scope->IsGlobal()) {
+        scope = scope->parent_scope_;
+    }
+    return scope;
+}
+
+bool Scope::IsGlobal() const {
+    return parent_scope_ == nullptr;
+}
+
+uint64_t Scope::GetGlobalVersion() {
+    return global_version_.load(std::memory_order_relaxed);
+}
+
+void Scope::OnChange() {
+    if (IsGlobal()) {
+        global_version_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
 Scope::Iterator Scope::begin() {
     return scope_.begin();
 }
@@ -0,0 +1,253 @@
+#include <stream.hpp>
+#include <error.hpp>
+#include <garbage_collection.hpp>
+
+namespace {
+bool IsFalse(Object* obj) {
+    return Is<Symbol>(obj) && As<Symbol>(obj)->GetName() == "#f";
+}
+
+Object* CallThunk(Object* thunk, Scope* scope) {
+    std::vector<Object*> args;
+    return As<Procedure>(thunk)->Invoke(FunctionArgs(args), scope);
+}
+
+Object* ForceValue(Object* obj, Scope* scope) {
+    auto promise = As<Promise>(obj);
+    if (!promise) {
+        return obj;
+    }
+    while (!promise->IsForced()) {
+        auto is_lazy = promise->IsLazy();
+        auto result = CallThunk(promise->GetThunk(), scope);
+        // The thunk may have forced the promise itself.
+        if (promise->IsForced()) {
+            break;
+        }
+        if (!is_lazy) {
+            promise->SetValue(result);
+            break;
+        }
+        ThrowRuntimeErrorIf(!Is<Promise>(result), "force: delay-force expected a promise");
+        promise->Adopt(As<Promise>(result));
+    }
+    return promise->GetValue();
+}
+
+Object* MakeDelay(FunctionArgs args, Scope* scope, bool is_lazy, std::string_view msg) {
+    ThrowSyntaxErrorIf(args.Size() != 1, msg);
+    auto thunk = MakeThunk(args.GetHead(), {args[0]}, scope);
+    return Heap::Instance().Make<Promise>(thunk, is_lazy);
+}
+
+// Forces a stream that may still be a promise and checks that it is one.
+Object* ForceStream(Object* stream, Scope* scope, std::string_view msg) {
+    stream = ForceValue(stream, scope);
+    ThrowRuntimeErrorIf(stream != nullptr && !Is<Cell>(stream), msg);
+    return stream;
+}
+
+Object* MakeStream(Object* first, Object* rest) {
+    auto& heap = Heap::Instance();
+    return heap.Make<Cell>(first, heap.Make<Promise>(rest, false));
+}
+
+size_t ToCount(Object* obj, std::string_view msg) {
+    auto value = Is<Number>(obj) ? std::get_if<int64_t>(&As<Number>(obj)->GetValue()) : nullptr;
+    ThrowRuntimeErrorIf(!value || *value < 0, msg);
+    return *value;
+}
+
+Object* MapStreams(Procedure* proc, std::vector<Object*> streams, Scope* scope);
+Object* FilterStream(Procedure* pred, Object* stream, Scope* scope);
+Object* TakeStream(size_t count, Object* stream, Scope* scope);
+
+// Thunks of the rests of native streams.
+
+class MapRest : public Procedure {
+public:
+    MapRest(Procedure* proc, std::vector<Object*> rests) : proc_(proc), rests_(std::move(rests)) {
+    }
+
+    Object* Call(FunctionArgs, Scope* scope) override {
+        return MapStreams(proc_, rests_, scope);
+    }
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override {
+        stack->push_back(proc_);
+        stack->insert(stack->end(), rests_.begin(), rests_.end());
+    }
+
+private:
+    Procedure* proc_;
+    std::vector<Object*> rests_;
+};
+
+class FilterRest : public Procedure {
+public:
+    FilterRest(Procedure* pred, Object* rest) : pred_(pred), rest_(rest) {
+    }
+
+    Object* Call(FunctionArgs, Scope* scope) override {
+        return FilterStream(pred_, rest_, scope);
+    }
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override {
+        stack->push_back(pred_);
+        stack->push_back(rest_);
+    }
+
+private:
+    Procedure* pred_;
+    Object* rest_;
+};
+
+class TakeRest : public Procedure {
+public:
+    TakeRest(size_t count, Object* rest) : count_(count), rest_(rest) {
+    }
+
+    Object* Call(FunctionArgs, Scope* scope) override {
+        return TakeStream(count_, rest_, scope);
+    }
+
+protected:
+    void PushReferences(std::vector<Object*>* stack) const override {
+        stack->push_back(rest_);
+    }
+
+private:
+    size_t count_;
+    Object* rest_;
+};
+
+Object* MapStreams(Procedure* proc, std::vector<Object*> streams, Scope* scope) {
+    std::vector<Object*> args;
+    for (auto& stream : streams) {
+        stream = ForceStream(stream, scope, "stream-map: expected streams");
+        if (!stream) {
+            return nullptr;
+        }
+        args.push_back(As<Cell>(stream)->GetFirst());
+        stream = As<Cell>(stream)->GetSecond();
+    }
+    auto first = proc->Invoke(FunctionArgs(args), scope);
+    return MakeStream(first, Heap::Instance().Make<MapRest>(proc, std::move(streams)));
+}
+
+// Skips rejected elements in a loop, without keeping the ones passed.
+Object* FilterStream(Procedure* pred, Object* stream, Scope* scope) {
+    while ((stream = ForceStream(stream, scope, "stream-filter: expected a stream"))) {
+        auto cell = As<Cell>(stream);
+        std::vector<Object*> args{cell->GetFirst()};
+        if (!IsFalse(pred->Invoke(FunctionArgs(args), scope))) {
+            auto rest = Heap::Instance().Make<FilterRest>(pred, cell->GetSecond());
+            return MakeStream(cell->GetFirst(), rest);
+        }
+        stream = cell->GetSecond();
+    }
+    return nullptr;
+}
+
+// The source is not forced past the last element taken.
+Object* TakeStream(size_t count, Object* stream, Scope* scope) {
+    if (count == 0 || !(stream = ForceStream(stream, scope, "stream-take: expected a stream"))) {
+        return nullptr;
+    }
+    auto cell = As<Cell>(stream);
+    auto rest = Heap::Instance().Make<TakeRest>(count - 1, cell->GetSecond());
+    return MakeStream(cell->GetFirst(), rest);
+}
+}  // namespace
+
+Object* Delay::Execute(FunctionArgs args, Scope* scope) {
+    return MakeDelay(args, scope, false, "delay: expected an expression");
+}
+
+Object* DelayForce::Execute(FunctionArgs args, Scope* scope) {
+    return MakeDelay(args, scope, true, "delay-force: expected an expression");
+}
+
+MakePromise::MakePromise() : Procedure({1, 1, "make-promise: expected 1 argument"}) {
+}
+
+Object* MakePromise::Call(FunctionArgs args, Scope*) {
+    return Is<Promise>(args[0]) ? args[0] : Heap::Instance().Make<Promise>(args[0]);
+}
+
+Force::Force() : Procedure({1, 1, "force: expected 1 argument"}) {
+}
+
+Object* Force::Call(FunctionArgs args, Scope* scope) {
+    return ForceValue(args[0], scope);
+}
+
+IsPromise::IsPromise() : Procedure({1, 1, "promise?: expected 1 argument"}) {
+}
+
+Object* IsPromise::Call(FunctionArgs args, Scope* scope) {
+    return scope->GetObject(Is<Promise>(args[0]) ? "#t" : "#f");
+}
+
+Object* ConsStream::Execute(FunctionArgs args, Scope* scope) {
+    ThrowSyntaxErrorIf(args.Size() != 2, "cons-stream: expected 2 expressions");
+    auto first = Process(args[0], scope);
+    return MakeStream(first, MakeThunk(args.GetHead(), {args[1]}, scope));
+}
+
+Object* StreamCar::Call(FunctionArgs args, Scope*) {
+    ThrowRuntimeErrorIf(args.Size() != 1 || !Is<Cell>(args[0]), "stream-car: expected a pair");
+    return As<Cell>(args[0])->GetFirst();
+}
+
+Object* StreamCdr::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(args.Size() != 1 || !Is<Cell>(args[0]), "stream-cdr: expected a pair");
+    return ForceValue(As<Cell>(args[0])->GetSecond(), scope);
+}
+
+Object* StreamMap::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(args.Size() < 2 || !As<Procedure>(args[0]),
+                        "stream-map: expected a procedure and streams");
+    return MapStreams(As<Procedure>(args[0]), std::vector(args.begin() + 1, args.end()), scope);
+}
+
+Object* StreamFilter::Call(FunctionArgs args, Scope* scope) {
+    ThrowRuntimeErrorIf(args.Size() != 2 || !As<Procedure>(args[0]),
+                        "stream-filter: expected a predicate and a stream");
+    return FilterStream(As<Procedure>(args[0]), args[1], scope);
+}
+
+StreamTake::StreamTake() : Procedure({2, 2, "stream-take: expected a count and a stream"}) {
+}
+
+Object* StreamTake::Call(FunctionArgs args, Scope* scope) {
+    return TakeStream(ToCount(args[0], "stream-take: expected a count and a stream"), args[1],
+                      scope);
+}
+
+StreamToList::StreamToList()
+    : Procedure({1, 2, "stream->list: expected an optional count and a stream"}) {
+}
+
+Object* StreamToList::Call(FunctionArgs args, Scope* scope) {
+    constexpr std::string_view kMsg = "stream->list: expected an optional count and a stream";
+    auto count = args.Size() == 2 ? ToCount(args[0], kMsg) : SIZE_MAX;
+    auto stream = args.Back();
+
+    auto& heap = Heap::Instance();
+    Object* head = nullptr;
+    Cell* last = nullptr;
+    for (; count != 0 && (stream = ForceStream(stream, scope, kMsg)); --count) {
+        auto cell = As<Cell>(heap.Make<Cell>(As<Cell>(stream)->GetFirst(), nullptr));
+        if (last) {
+            last->SetSecond(cell);
+        } else {
+            head = cell;
+        }
+        last = cell;
+        stream = As<Cell>(stream)->GetSecond();
+    }
+    return head;
+}
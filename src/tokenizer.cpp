@@ -1,21 +1,110 @@
 #include <tokenizer.hpp>
 #include <error.hpp>
+#include <string_view>
 
 namespace {
+void ReadDigits(std::istream* in, std::string* buf) {
+    while (std::isdigit(in->peek())) {
+        buf->push_back(in->get());
+    }
+}
+
+// Reads [sign] digits [. digits] [e [sign] digits], a leading dot is allowed.
 ConstantToken ReadConstant(std::istream* in) {
-    int32_t constant;
-    *in >> constant;
-    return ConstantToken{constant};
+    std::string buf(1, in->get());
+    ReadDigits(in, &buf);
+    if (in->peek() == '.') {
+        buf.push_back(in->get());
+        ReadDigits(in, &buf);
+    }
+    if (in->peek() == 'e' || in->peek() == 'E') {
+        buf.push_back(in->get());
+        if (in->peek() == '-' || in->peek() == '+') {
+            buf.push_back(in->get());
+        }
+        ReadDigits(in, &buf);
+    }
+    return ConstantToken{ParseNumber(buf)};
 }
 
-SymbolToken ReadSymbol(std::istream* in) {
+std::string ReadSymbolName(std::istream* in) {
     std::string buf{};
     char next{};
     do {
         buf.push_back(in->get());
         next = in->peek();
     } while (next != EOF && next != ')' && !std::isspace(next));
-    return SymbolToken{std::move(buf)};
+    return buf;
+}
+
+SymbolToken ReadSymbol(std::istream* in) {
+    return SymbolToken{ReadSymbolName(in)};
+}
+
+StringToken ReadString(std::istream* in) {
+    in->get();
+    std::string buf;
+    while (true) {
+        auto next = in->get();
+        if (next == EOF) {
+            throw SyntaxError("Unterminated string literal");
+        }
+        if (next == '"') {
+            return StringToken{std::move(buf)};
+        }
+        if (next == '\\') {
+            switch (in->get()) {
+                case 'n':
+                    next = '\n';
+                    break;
+                case 't':
+                    next = '\t';
+                    break;
+                case '"':
+                    next = '"';
+                    break;
+                case '\\':
+                    next = '\\';
+                    break;
+                default:
+                    throw SyntaxError("Unknown escape sequence in string literal");
+            }
+        }
+        buf.push_back(static_cast<char>(next));
+    }
+}
+
+// Reads the rest of "#u8(" after "#", anything else is a symbol.
+Token ReadBytevectorOpenBracket(std::istream* in) {
+    std::string prefix = "#";
+    for (char expected : {'u', '8'}) {
+        if (in->peek() != expected) {
+            break;
+        }
+        prefix.push_back(in->get());
+    }
+    if (prefix == "#u8" && in->peek() == '(') {
+        in->get();
+        return BytevectorOpenBracketToken{};
+    }
+    auto next = in->peek();
+    if (next == EOF || next == ')' || std::isspace(next)) {
+        return SymbolToken{std::move(prefix)};
+    }
+    return SymbolToken{prefix + ReadSymbolName(in)};
+}
+
+bool IsDigitAfter(std::istream* in, char prefix) {
+    in->get();
+    bool result = std::isdigit(in->peek());
+    in->putback(prefix);
+    return result;
+}
+bool IsDotAfter(std::istream* in, char prefix) {
+    in->get();
+    bool result = in->peek() == '.';
+    in->putback(prefix);
+    return result;
 }
 }  // namespace
 
@@ -31,12 +120,19 @@ Token Tokenizer::GetToken() const {
     return token_;
 }
 
+size_t Tokenizer::GetPosition() const {
+    return position_;
+}
+
 void Tokenizer::Next() {
     char next = istream_->peek();
     while (std::isspace(next)) {
         istream_->get();
         next = istream_->peek();
     }
+    if (!istream_->eof()) {
+        position_ = istream_->tellg();
+    }
 
     if (next == '(') {
         token_ = OpenBracketToken{};
@@ -51,14 +147,33 @@ void Tokenizer::Next() {
         istream_->get();
 
     } else if (next == '.') {
-        token_ = DotToken{};
-        istream_->get();
+        if (IsDigitAfter(istream_, next)) {
+            token_ = ReadConstant(istream_);
+        } else if (IsDotAfter(istream_, next)) {
+            // The ellipsis of syntax-rules is the only name starting with a dot.
+            auto name = ReadSymbolName(istream_);
+            if (name != "...") {
+                throw SyntaxError("Unexpected token");
+            }
+            token_ = SymbolToken{std::move(name)};
+        } else {
+            token_ = DotToken{};
+            istream_->get();
+        }
 
     } else if (next == '-' || next == '+') {
         char sign = istream_->get();
-        if (std::isdigit(istream_->peek())) {
-            istream_->unget();
+        if (std::isdigit(istream_->peek()) ||
+            (istream_->peek() == '.' && IsDigitAfter(istream_, '.'))) {
+            istream_->putback(sign);
             token_ = ReadConstant(istream_);
+        } else if (istream_->peek() == 'i' || istream_->peek() == 'n') {
+            auto name = sign + ReadSymbolName(istream_);
+            if (name == "+inf.0" || name == "-inf.0" || name == "+nan.0" || name == "-nan.0") {
+                token_ = ConstantToken{ParseNumber(name)};
+            } else {
+                token_ = SymbolToken{std::move(name)};
+            }
         } else {
             token_ = SymbolToken{std::string(1, sign)};
         }
@@ -66,8 +181,23 @@ void Tokenizer::Next() {
     } else if (std::isdigit(next)) {
         token_ = ReadConstant(istream_);
 
-    } else if (std::isalpha(next) || next == '<' || next == '=' || next == '>' || next == '*' ||
-               next == '/' || next == '#') {
+    } else if (next == '"') {
+        token_ = ReadString(istream_);
+
+    } else if (next == '#') {
+        istream_->get();
+        if (istream_->peek() == '(') {
+            token_ = VectorOpenBracketToken{};
+            istream_->get();
+        } else if (istream_->peek() == 'u') {
+            token_ = ReadBytevectorOpenBracket(istream_);
+        } else {
+            istream_->putback(next);
+            token_ = ReadSymbol(istream_);
+        }
+
+    } else if (std::isalpha(next) ||
+               std::string_view("<=>*/!$%&:?^_~").find(next) != std::string_view::npos) {
         token_ = ReadSymbol(istream_);
 
     } else if (next == EOF) {
@@ -98,6 +228,18 @@ bool CloseBracketToken::operator==(const CloseBracketToken&) const {
     return true;
 }
 
+bool VectorOpenBracketToken::operator==(const VectorOpenBracketToken&) const {
+    return true;
+}
+
+bool BytevectorOpenBracketToken::operator==(const BytevectorOpenBracketToken&) const {
+    return true;
+}
+
+bool StringToken::operator==(const StringToken& other) const {
+    return value == other.value;
+}
+
 bool ConstantToken::operator==(const ConstantToken& other) const {
     return value == other.value;
 }